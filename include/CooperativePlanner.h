@@ -0,0 +1,157 @@
+#ifndef COOPERATIVEPLANNER_H
+#define COOPERATIVEPLANNER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <unordered_set>
+
+
+// Space-time reservations of a planning window.
+// Cell, time and owning agent are packed into a single 64 bit word and kept in
+// an open addressing table, so a lookup touches one or two cache lines.
+class cReservationTable
+{
+  public:
+    cReservationTable();
+
+    // drops all reservations and makes room for about nReservations of them
+    void Clear(size_t nReservations);
+
+    // returns false if the cell is already taken at that time
+    bool Reserve(const int nCell, const int nTime, const int nAgent);
+
+    // returns the agent holding the cell at that time or -1
+    int Owner(const int nCell, const int nTime) const;
+
+  private:
+    static const uint64_t EMPTY = ~0ull;
+
+    static uint64_t Key(const int nCell, const int nTime)
+    {
+      return (static_cast<uint64_t>(nCell) << 32) | (static_cast<uint64_t>(nTime) << 24);
+    }
+
+    size_t Slot(const uint64_t nKey) const
+    {
+      return static_cast<size_t>(((nKey >> 24) * 0x9E3779B97F4A7C15ull) >> nShift);
+    }
+
+    // cell in bits 32-63, time in bits 24-31, agent in bits 0-23
+    std::vector<uint64_t> vecSlots;
+    size_t nMask  = 0;
+    int    nShift = 64;
+};
+
+
+// Cooperative planning of a group of agents (Windowed Hierarchical Cooperative A*).
+// Agents are planned one after another, each one with a space-time A* that avoids the
+// cells and moves reserved by the agents planned before it, up to nWindow steps ahead.
+// The heuristic is the true distance to the agent's goal, which comes from the
+// DistanceMap of a cPathfinderWorker search started at the goal.
+// The caller executes the plans and calls Plan again every nWindow/2 steps.
+class cCooperativePlanner
+{
+  public:
+    cCooperativePlanner(const unsigned char* _pMap, const int _nMapWidth, const int _nMapHeight,
+                        const int _nWindow);
+    ~cCooperativePlanner();
+
+    // returns the id of the new agent, agents added first are planned first
+    int AddAgent(const int nStartX, const int nStartY, const int nTargetX, const int nTargetY);
+
+    // the game moved the agent somewhere else than planned
+    void SetPosition(const int nAgent, const int nX, const int nY);
+
+    // plans every agent for the next window, returns the number of agents without a plan
+    int Plan();
+
+    // cell index the agent should occupy nStep steps after the last Plan, nStep <= nWindow
+    int getPlannedCell(const int nAgent, const int nStep){return vecAgents[nAgent].vecPlan[nStep];}
+    int getCell(const int nAgent){return vecAgents[nAgent].nCell;}
+    bool isAtTarget(const int nAgent){return vecAgents[nAgent].nCell == vecAgents[nAgent].nTarget;}
+
+    int getWindow(){return nWindow;}
+    size_t getAgentCount(){return vecAgents.size();}
+
+    // statistics
+    size_t getWindowSearches(){return nWindowSearches;}
+    size_t getDistanceSearches(){return nDistanceSearches;}
+    size_t getNodesExpanded(){return nNodesExpanded;}
+
+    // agents that could not keep clear of a cell another agent had reserved,
+    // counted after the last planning round of every Plan
+    size_t getConflicts(){return nConflicts;}
+
+  private:
+    struct sAgent
+    {
+      int nCell;
+      int nTarget;
+
+      // cells for every step of the current window, starting with the current one
+      std::vector<int> vecPlan;
+
+      // distances to the target, sorted by cell
+      std::vector<std::pair<int, unsigned int> > vecDistances;
+      unsigned int nMaxDistance;
+
+      // the last distance search went through everything reachable from the target
+      bool bUnreachable;
+
+      // the plan collides with a cell reserved by an agent planned earlier
+      bool bConflict;
+    };
+
+    struct sSpaceTimeNode
+    {
+      int nCell;
+      int nTime;
+      int nCost;
+      int nParent;
+    };
+
+    bool PlanAgent(const int nAgent);
+
+    // runs a cPathfinderWorker search from the target to the agent
+    void FindDistances(sAgent& agent);
+
+    // true distance to the target, or a lower bound if the search has not got there
+    unsigned int Distance(const sAgent& agent, const int nCell);
+
+    // agents that reached their target stay there till the end of the window
+    bool IsTargetFree(const int nAgent, const int nCell, const int nTime);
+
+    const unsigned char* pMap;
+    int nMapWidth;
+    int nMapHeight;
+    int nWindow;
+
+    std::vector<sAgent> vecAgents;
+    cReservationTable Reservations;
+
+    // Agents are planned in this order. An agent that got boxed in and collided with
+    // an earlier plan moves to the front, so the others plan around it
+    std::vector<int> vecOrder;
+    static const int MAX_PLANNING_ROUNDS = 4;
+
+    // reused between the searches
+    std::vector<sSpaceTimeNode> vecNodes;
+    std::unordered_set<uint64_t> setClosed;
+    std::vector<int> vecPathBuffer;
+
+    size_t nWindowSearches   = 0;
+    size_t nDistanceSearches = 0;
+    size_t nNodesExpanded    = 0;
+    size_t nConflicts        = 0;
+
+    // Four allowed directions to move and waiting in place
+    std::pair<char,char> DIR[5] = { std::make_pair( 0, 0),
+                                    std::make_pair( 1, 0),
+                                    std::make_pair(-1, 0),
+                                    std::make_pair( 0, 1),
+                                    std::make_pair( 0,-1)};
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef FRONTIERSEARCH_H
+#define FRONTIERSEARCH_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+#include "MapPreprocessor.h"
+
+
+// Memory bounded alternative to cPathfinderWorker.
+// Runs a bidirectional breadth-first frontier search that keeps only the last two
+// layers of each wave instead of the whole DistanceMap. Once the waves meet, the
+// meeting node is known to lie on a shortest path and both halves are solved again
+// recursively (divide and conquer) until they are short enough to be solved directly.
+// The output written to pOutBuffer matches cPathfinderWorker::Reconstruct.
+class cFrontierSearchWorker
+{
+  public:
+    cFrontierSearchWorker();
+    ~cFrontierSearchWorker();
+
+    // caps the amount of memory the search is allowed to hold at once
+    void UseMemoryLimit(size_t _nMemoryLimitBytes);
+
+    // skips dead ends found by the preprocessor. Corridors are still walked
+    // cell by cell because the waves advance one layer at a time
+    void UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed);
+
+    // returns path legth if it is found or -1 on failure
+    int FindPath(const int nStartX, const int nStartY,
+                 const int nTargetX, const int nTargetY,
+                 const unsigned char* pMap,
+                 const int nMapWidth, const int nMapHeight,
+                 int* pOutBuffer, const int nOutBufferSize);
+
+    // statistics of the last FindPath call
+    size_t getPeakMemoryBytes(){return nPeakMemoryBytes;}
+    size_t getNodesExpanded(){return nNodesExpanded;}
+    bool   isMemoryExceeded(){return bMemoryExceeded;}
+
+  private:
+    // finds a node that lies on a shortest path between nFrom and nTo.
+    // returns the distance between them or -1, nMeet receives the node and
+    // nMeetDepth its distance from nFrom
+    int Meet(const int nFrom, const int nTo, const int nMaxDepth,
+             int& nMeet, int& nMeetDepth);
+
+    // writes the nodes of a nLength long shortest path between nFrom and nTo,
+    // excluding nFrom, given that nFrom is nDepth steps away from the start
+    bool Solve(const int nFrom, const int nTo, const int nDepth, const int nLength);
+
+    // breadth-first search inside a small box for short segments
+    bool SolveDirect(const int nFrom, const int nTo, const int nDepth, const int nLength);
+
+    // produces the next layer of a wave from its current and previous layers
+    bool Expand(std::vector<int>& vecPrev, std::vector<int>& vecCurr, std::vector<int>& vecNext);
+
+    bool IsTraversable(const int nX, const int nY)
+    {
+      if (nX < 0 || nX >= nMapWidth || nY < 0 || nY >= nMapHeight ||
+          pMap[nY*nMapWidth+nX] != 1) return false;
+
+      // Dead ends only matter when the start or target lies inside
+      return pPreprocessed == nullptr || !pPreprocessed->isDeadEnd(nY*nMapWidth+nX) ||
+             std::binary_search(vecDeadEndExits.begin(), vecDeadEndExits.end(), nY*nMapWidth+nX);
+    }
+
+    // keeps track of the memory held by the layers
+    bool CheckMemory(size_t nExtraBytes);
+    size_t AllocatedBytes();
+
+    const unsigned char* pMap = nullptr;
+    int nMapWidth  = 0;
+    int nMapHeight = 0;
+
+    const cMapPreprocessor* pPreprocessed = nullptr;
+    std::vector<int> vecDeadEndExits;
+
+    int* pOutBuffer   = nullptr;
+    int  nPathLength  = 0;
+
+    size_t nMemoryLimitBytes = 64*1024*1024;
+    size_t nPeakMemoryBytes  = 0;
+    size_t nNodesExpanded    = 0;
+    bool   bMemoryExceeded   = false;
+
+    // Segments no longer than this are solved directly
+    int nDirectSolveLength = 32;
+
+    // Two layers per wave are enough to never revisit a node on a 4-connected grid
+    std::vector<int> vecFromPrev, vecFromCurr;
+    std::vector<int> vecToPrev,   vecToCurr;
+    std::vector<int> vecNext;
+    std::vector<unsigned char> vecBox;
+
+    // Four allowed directions to move
+    std::pair<char,char> DIR[4] = { std::make_pair( 1, 0),
+                                    std::make_pair(-1, 0),
+                                    std::make_pair( 0, 1),
+                                    std::make_pair( 0,-1)};
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef MAPPREPROCESSOR_H
+#define MAPPREPROCESSOR_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+
+// One-time analysis of a map that lets the searches skip useless parts of it.
+// - Dead ends are found by repeatedly peeling cells with at most one traversable
+//   neighbour. Such a cell can never lie on a path between two other cells, unless
+//   the path starts or ends inside its dead end region. Every dead end cell keeps
+//   the direction of the neighbour that outlived it, which leads out of the region.
+// - Corridors are the remaining cells with exactly two traversable neighbours.
+//   Every corridor becomes a weighted edge between the cells at its two ends,
+//   so searches jump over it with a single lookup.
+// The map is processed in tiles on a pool of threads. Cells are indexed the same
+// way as pMap: nY*nMapWidth+nX.
+class cMapPreprocessor
+{
+  public:
+    // A corridor as seen when entering it at nCell from the junction nFrom
+    struct sCorridorEnd
+    {
+      int nCell;
+      int nFrom;
+      int nExit;       // junction past the other end
+      int nLength;     // number of corridor cells
+      int nFirst;      // position of nCell in vecCorridorCells
+      int nStep;       // direction to walk vecCorridorCells in, +1 or -1
+      int nCorridor;   // same for both ends of a corridor
+    };
+
+    cMapPreprocessor();
+    ~cMapPreprocessor();
+
+    void UseTiles(unsigned int _nTileSize, unsigned int _nThreads);
+
+    void Preprocess(const unsigned char* pMap, const int nMapWidth, const int nMapHeight);
+
+    bool isDeadEnd(const int nIndex) const {return vecFlags[nIndex] & FLAG_DEADEND;}
+    bool isCorridor(const int nIndex) const {return vecFlags[nIndex] & FLAG_CORRIDOR;}
+
+    // appends the cells leading from a dead end cell out of its region
+    void DeadEndExit(const int nIndex, std::vector<int>& vecExit) const;
+
+    // returns the corridor entered at nCell from nFrom, or nullptr if nCell is not
+    // one of its ends or nFrom lies inside it. Corridors that form a ring have no ends
+    const sCorridorEnd* FindCorridor(const int nFrom, const int nCell) const;
+
+    // writes the cells of a corridor in the order they are passed
+    void CorridorCells(const sCorridorEnd* pCorridor, int* pCells) const;
+
+    size_t getDeadEndCount(){return nDeadEndCount;}
+    size_t getCorridorCount(){return nCorridorCount;}
+
+  private:
+    // per tile passes, run in parallel
+    void CountNeighbours(const int nTile);
+    void PeelTile(const int nTile);
+    void MarkCorridors(const int nTile);
+
+    // stores the corridor starting at nCell and its ends
+    void LinkCorridor(const int nFrom, const int nCell);
+
+    // runs a pass over every tile on the thread pool
+    void ForEachTile(void (cMapPreprocessor::*Pass)(const int));
+
+    // removes a dead end cell and returns the index of its surviving neighbour or -1
+    int Peel(const int nIndex);
+
+    int TileOf(const int nX, const int nY) const
+    {
+      return (nY/nTileSize)*nTilesX + nX/nTileSize;
+    }
+
+    bool IsTraversable(const int nX, const int nY) const
+    {
+      return nX >= 0 && nX < nMapWidth && nY >= 0 && nY < nMapHeight &&
+             pMap[nY*nMapWidth+nX] == 1;
+    }
+
+    static const unsigned char FLAG_EXIT_DIR  = 0x03;  // direction towards the exit
+    static const unsigned char FLAG_HAS_EXIT  = 0x04;
+    static const unsigned char FLAG_DEADEND   = 0x08;
+    static const unsigned char FLAG_CORRIDOR  = 0x10;
+    static const unsigned char FLAG_LINKED    = 0x20;  // corridor cell is in vecCorridorCells
+
+    const unsigned char* pMap = nullptr;
+    int nMapWidth  = 0;
+    int nMapHeight = 0;
+
+    unsigned int nTileSize = 256;
+    unsigned int nThreads  = 4;
+    int nTilesX = 0;
+    int nTilesY = 0;
+
+    size_t nDeadEndCount  = 0;
+    size_t nCorridorCount = 0;
+
+    // One byte per cell that holds the results
+    std::vector<unsigned char> vecFlags;
+
+    // Number of traversable neighbours that are not dead ends yet
+    std::vector<unsigned char> vecDegree;
+
+    // Cells of every corridor from one end to the other, and both ends of every
+    // corridor sorted by nCell and nFrom
+    std::vector<int> vecCorridorCells;
+    std::vector<sCorridorEnd> vecCorridorEnds;
+
+    // Four allowed directions to move
+    std::pair<char,char> DIR[4] = { std::make_pair( 1, 0),
+                                    std::make_pair(-1, 0),
+                                    std::make_pair( 0, 1),
+                                    std::make_pair( 0,-1)};
+};
+
+#endif
@@ -7,6 +7,8 @@
 
 typedef std::pair<int, int> Node;
 
+class cMapPreprocessor;
+
 
 class cPathfinderWorker
 {
@@ -19,6 +21,9 @@ class cPathfinderWorker
 
     void UseManhattanBBox(bool _bUseManhattanBbox, unsigned int _nMDWindowSize);
 
+    // skips dead ends and jumps over corridors found by the preprocessor
+    void UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed);
+
     
     // returns path legth if it is found or -1 on failure
     int FindPath(const int nStartX, const int nStartY,
@@ -33,6 +38,15 @@ class cPathfinderWorker
     // Control the state of the worker
     void stopSearching(){*bKeepSearching = false;}    
     bool isSearching(){return *bKeepSearching;}
+
+    size_t getNodesExpanded(){return nNodesExpanded;}
+
+    // corridor cells stepped through one by one, only corridors holding the start
+    // or target are walked, every other one is crossed with a single lookup
+    size_t getCorridorCellsWalked(){return nCorridorCellsWalked;}
+
+    // distances from the start of the last search to every node it has reached
+    const std::map<Node, unsigned int>& getDistanceMap(){return DistanceMap;}
     
   private:
     // internal function that initiates the seach
@@ -42,6 +56,15 @@ class cPathfinderWorker
                 const int nMapWidth, const int nMapHeight,
                 const int nOutBufferSize);
 
+    // follows a corridor entered from (nFromX,nFromY) at (nX,nY) until its far end,
+    // moves (nX,nY) there and returns the number of extra steps taken.
+    // Cells passed on the way are written to pCells if it is given
+    unsigned int JumpCorridor(unsigned int nFromX, unsigned int nFromY,
+                              unsigned int& nX, unsigned int& nY, int* pCells);
+
+    // id of the corridor holding the cell or -1, such corridors have to be walked
+    int CorridorOf(const int nIndex);
+
     // variables to hold intermediate values during the searches
     unsigned int nCurrX = 0;
     unsigned int nCurrY = 0;
@@ -55,6 +78,7 @@ class cPathfinderWorker
     
     bool bPathFound = false;
     bool* bKeepSearching;
+    bool  bKeepSearchingAlone;   // used when there is no other search to stop us
 
     
     bool bUseMultipleThreads = false;
@@ -63,6 +87,18 @@ class cPathfinderWorker
     bool bUseManhattanBbox = false;
     unsigned int nMDWindowSize = 3;
 
+    const cMapPreprocessor* pPreprocessed = nullptr;
+    const unsigned char* pMap;
+    int nStartIndex;
+    int nTargetIndex;
+    int nStartCorridor;
+    int nTargetCorridor;
+
+    // dead end cells that the current search is still allowed to enter
+    std::vector<int> vecDeadEndExits;
+
+    size_t nNodesExpanded = 0;
+    size_t nCorridorCellsWalked = 0;
     
     // Holds the information about the distance from start to node
     std::map<Node, unsigned int> DistanceMap;
@@ -79,6 +115,14 @@ class cPathfinder
   public:
     cPathfinder(bool _bUseMultipleThreads,
                 bool _bUseManhattanBbox);
+
+    // single threaded searches go through cFrontierSearchWorker and hold at most
+    // nMemoryLimitBytes instead of the full DistanceMap
+    void UseMemoryLimit(bool _bUseMemoryLimit, size_t _nMemoryLimitBytes);
+
+    // single threaded searches skip the dead ends and corridors found by the
+    // preprocessor, which has to outlive the searches
+    void UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed);
     
     // returns path legth if it is found or -1 on failure
     int FindPath(const int nStartX, const int nStartY,
@@ -86,6 +130,10 @@ class cPathfinder
                  const unsigned char* pMap,
                  const int nMapWidth, const int nMapHeight,
                  int* pOutBuffer, const int nOutBufferSize);
+
+    // true if the last FindPath returned -1 because it ran out of its memory limit,
+    // a path may still exist
+    bool isMemoryExceeded(){return bMemoryExceeded;}
     
   private:    
     int  nResult;              // Variable to hold the result of execution
@@ -93,4 +141,10 @@ class cPathfinder
     
     bool bUseMultipleThreads;
     bool bUseManhattanBbox;
+
+    bool   bUseMemoryLimit = false;
+    size_t nMemoryLimitBytes;
+    bool   bMemoryExceeded = false;
+
+    const cMapPreprocessor* pPreprocessed = nullptr;
 };
\ No newline at end of file
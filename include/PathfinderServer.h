@@ -0,0 +1,149 @@
+#ifndef PATHFINDERSERVER_H
+#define PATHFINDERSERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+class cMapPreprocessor;
+
+
+// A single query as it travels over the socket
+struct sPathQuery
+{
+  int nStartX;
+  int nStartY;
+  int nTargetX;
+  int nTargetY;
+  int nOutBufferSize;
+};
+
+// First message every client receives after connecting
+struct sSharedMapInfo
+{
+  int  nMapWidth;
+  int  nMapHeight;
+  char sSharedMemoryName[64];
+};
+
+
+// Local pathfinding service for several processes on the same host.
+// The map is loaded once into POSIX shared memory with mode 0444, so clients can
+// only map it read-only (processes running as root are not held back by the mode).
+// Clients connect over a Unix socket and send batches of queries:
+//   client -> server : unsigned int nQueries, sPathQuery[nQueries]
+//   server -> client : for every query int nResult followed by nResult path nodes
+//                      when the path has been found and fits the out buffer
+// Queries are run with cPathfinder on a pool of worker threads.
+class cPathfinderServer
+{
+  public:
+    cPathfinderServer(std::string _sSocketPath, std::string _sSharedMemoryName,
+                      unsigned int _nThreads);
+    ~cPathfinderServer();
+
+    // loads a map file into shared memory
+    bool LoadMap(std::string path, const int _nMapWidth, const int _nMapHeight);
+
+    // preprocesses the map once so that every query can skip its dead ends
+    void UsePreprocessing(bool _bUsePreprocessing);
+
+    // serves clients until Stop is called
+    bool Run();
+
+    // safe to call from a signal handler
+    void Stop();
+
+  private:
+    struct sBatch;
+
+    struct sTask
+    {
+      const sPathQuery* pQuery;
+      int* pResult;
+      std::vector<int>* pPath;
+      sBatch* pBatch;
+    };
+
+    struct sBatch
+    {
+      std::mutex mtx;
+      std::condition_variable cvDone;
+      int nPending;
+    };
+
+    // runs on its own thread for every connected client
+    void ServeClient(int nSocket);
+    void Serve(int nSocket);
+    void Work();
+
+    static const unsigned int MAX_BATCH_SIZE = 65536;
+
+    std::string sSocketPath;
+    std::string sSharedMemoryName;
+    unsigned int nThreads;
+
+    unsigned char* pMap = nullptr;
+    int nMapWidth  = 0;
+    int nMapHeight = 0;
+
+    bool bUsePreprocessing = false;
+    cMapPreprocessor* pPreprocessed = nullptr;
+
+    int nListenSocket = -1;
+    std::atomic<bool> bRunning;
+
+    // Sockets of the clients that are still connected
+    std::vector<int> vecClientSockets;
+    std::mutex mtxClients;
+    std::condition_variable cvClients;
+
+    // Queries waiting for a worker
+    std::deque<sTask> Tasks;
+    std::mutex mtxTasks;
+    std::condition_variable cvTasks;
+    bool bStopWorkers = false;
+};
+
+
+// Client side of cPathfinderServer
+class cPathfinderClient
+{
+  public:
+    cPathfinderClient(std::string _sSocketPath);
+    ~cPathfinderClient();
+
+    // connects to the server and maps the shared map read-only
+    bool Connect();
+
+    const unsigned char* getMap(){return pMap;}
+    int getMapWidth(){return nMapWidth;}
+    int getMapHeight(){return nMapHeight;}
+
+    // same as cPathfinder::FindPath, the search runs on the server's copy of the map,
+    // pMap is only expected to be either getMap() or nullptr
+    int FindPath(const int nStartX, const int nStartY,
+                 const int nTargetX, const int nTargetY,
+                 const unsigned char* pMap,
+                 const int nMapWidth, const int nMapHeight,
+                 int* pOutBuffer, const int nOutBufferSize);
+
+    // runs all queries in a single round trip, vecOutBuffers[i] receives the path of
+    // vecQueries[i]. returns false if the connection failed
+    bool FindPaths(const std::vector<sPathQuery>& vecQueries,
+                   const std::vector<int*>& vecOutBuffers, std::vector<int>& vecResults);
+
+  private:
+    std::string sSocketPath;
+    int nSocket = -1;
+
+    const unsigned char* pMap = nullptr;
+    int nMapWidth  = 0;
+    int nMapHeight = 0;
+};
+
+#endif
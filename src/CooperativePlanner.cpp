@@ -0,0 +1,279 @@
+#include "CooperativePlanner.h"
+#include "Pathfinder.h"
+
+#include <cstdio>
+#include <queue>
+#include <algorithm>
+
+
+const uint64_t cReservationTable::EMPTY;
+
+cReservationTable::cReservationTable()
+{
+}
+
+void cReservationTable::Clear(size_t nReservations)
+{
+  // keep the table at most half full so that probe sequences stay short
+  size_t nCapacity = 64;
+  nShift = 58;
+  while (nCapacity < 2*nReservations)
+  {
+    nCapacity *= 2;
+    --nShift;
+  }
+
+  nMask = nCapacity-1;
+  vecSlots.assign(nCapacity, EMPTY);
+}
+
+bool cReservationTable::Reserve(const int nCell, const int nTime, const int nAgent)
+{
+  uint64_t nKey = Key(nCell, nTime);
+  for (size_t nSlot = Slot(nKey); ; nSlot = (nSlot+1) & nMask)
+  {
+    if (vecSlots[nSlot] == EMPTY)
+    {
+      vecSlots[nSlot] = nKey | static_cast<uint64_t>(nAgent);
+      return true;
+    }
+    if ((vecSlots[nSlot] & ~0xFFFFFFull) == nKey) return static_cast<int>(vecSlots[nSlot] & 0xFFFFFF) == nAgent;
+  }
+}
+
+int cReservationTable::Owner(const int nCell, const int nTime) const
+{
+  uint64_t nKey = Key(nCell, nTime);
+  for (size_t nSlot = Slot(nKey); ; nSlot = (nSlot+1) & nMask)
+  {
+    if (vecSlots[nSlot] == EMPTY) return -1;
+    if ((vecSlots[nSlot] & ~0xFFFFFFull) == nKey) return static_cast<int>(vecSlots[nSlot] & 0xFFFFFF);
+  }
+}
+
+
+
+cCooperativePlanner::cCooperativePlanner(const unsigned char* _pMap,
+                                         const int _nMapWidth, const int _nMapHeight,
+                                         const int _nWindow)
+{
+  pMap       = _pMap;
+  nMapWidth  = _nMapWidth;
+  nMapHeight = _nMapHeight;
+
+  // time has to fit into the 8 bits of a reservation
+  nWindow = std::min(std::max(_nWindow, 1), 255);
+}
+
+cCooperativePlanner::~cCooperativePlanner()
+{
+}
+
+
+int cCooperativePlanner::AddAgent(const int nStartX, const int nStartY,
+                                  const int nTargetX, const int nTargetY)
+{
+  sAgent agent;
+  agent.nCell   = nStartY*nMapWidth+nStartX;
+  agent.nTarget = nTargetY*nMapWidth+nTargetX;
+  agent.vecPlan.assign(nWindow+1, agent.nCell);
+  agent.nMaxDistance = 0;
+  agent.bUnreachable = false;
+  agent.bConflict = false;
+
+  vecAgents.push_back(agent);
+  vecOrder.push_back(vecAgents.size()-1);
+  return vecAgents.size()-1;
+}
+
+void cCooperativePlanner::SetPosition(const int nAgent, const int nX, const int nY)
+{
+  vecAgents[nAgent].nCell = nY*nMapWidth+nX;
+}
+
+
+int cCooperativePlanner::Plan()
+{
+  int nUnplanned = 0;
+  std::vector<int> vecConflicts;
+
+  for (int nRound = 0; nRound < MAX_PLANNING_ROUNDS; ++nRound)
+  {
+    Reservations.Clear(vecAgents.size()*(nWindow+2));
+
+    // Nobody may step into a cell that is occupied right now,
+    // the agents that are planned later have not decided to leave yet
+    for (size_t i=0; i<vecAgents.size(); ++i)
+    {
+      Reservations.Reserve(vecAgents[i].nCell, 0, i);
+      Reservations.Reserve(vecAgents[i].nCell, 1, i);
+    }
+
+    nUnplanned = 0;
+    vecConflicts.clear();
+    for (auto nAgent : vecOrder)
+    {
+      if (!PlanAgent(nAgent)) ++nUnplanned;
+      if (vecAgents[nAgent].bConflict) vecConflicts.push_back(nAgent);
+    }
+    if (vecConflicts.empty()) break;
+
+    // plan the agents that were in the way first and everybody else again
+    std::stable_partition(vecOrder.begin(), vecOrder.end(),
+                          [this](int nAgent){return vecAgents[nAgent].bConflict;});
+  }
+
+  nConflicts += vecConflicts.size();
+  return nUnplanned;
+}
+
+
+bool cCooperativePlanner::PlanAgent(const int nAgent)
+{
+  sAgent& agent = vecAgents[nAgent];
+  agent.bConflict = false;
+  ++nWindowSearches;
+
+  // the agent left the area the last distance search has covered
+  if (!agent.bUnreachable &&
+      !std::binary_search(agent.vecDistances.begin(), agent.vecDistances.end(),
+                          std::make_pair(agent.nCell, 0u),
+                          [](const std::pair<int, unsigned int>& a, const std::pair<int, unsigned int>& b)
+                          {return a.first < b.first;}))
+  {
+    FindDistances(agent);
+  }
+
+  vecNodes.clear();
+  setClosed.clear();
+
+  // nodes with equal estimates are taken deepest first
+  typedef std::pair<int, int> OpenNode;
+  std::priority_queue<OpenNode, std::vector<OpenNode>, std::greater<OpenNode> > OpenNodes;
+
+  sSpaceTimeNode start = {agent.nCell, 0, 0, -1};
+  vecNodes.push_back(start);
+  OpenNodes.push(std::make_pair(Distance(agent, agent.nCell)*(nWindow+1) + nWindow, 0));
+
+  int nBest = -1;
+  while (!OpenNodes.empty())
+  {
+    int nNode = OpenNodes.top().second;
+    OpenNodes.pop();
+
+    sSpaceTimeNode node = vecNodes[nNode];
+    if (!setClosed.insert((static_cast<uint64_t>(node.nCell) << 8) | node.nTime).second) continue;
+    ++nNodesExpanded;
+
+    // done once the window is filled or the agent can rest at its target
+    if (node.nTime == nWindow || (node.nCell == agent.nTarget && IsTargetFree(nAgent, node.nCell, node.nTime)))
+    {
+      nBest = nNode;
+      break;
+    }
+
+    int nCurrX = node.nCell % nMapWidth;
+    int nCurrY = node.nCell / nMapWidth;
+
+    for (int i=0; i<5; ++i)
+    {
+      int nAdjX = nCurrX+DIR[i].first;
+      int nAdjY = nCurrY+DIR[i].second;
+      if (nAdjX < 0 || nAdjX >= nMapWidth || nAdjY < 0 || nAdjY >= nMapHeight) continue;
+
+      int nAdj = nAdjY*nMapWidth+nAdjX;
+      if (pMap[nAdj] != 1) continue;
+
+      // the cell has to be free when we get there
+      int nOwner = Reservations.Owner(nAdj, node.nTime+1);
+      if (nOwner >= 0 && nOwner != nAgent) continue;
+
+      // and nobody may come the opposite way at the same time
+      nOwner = Reservations.Owner(nAdj, node.nTime);
+      if (nOwner >= 0 && nOwner != nAgent && Reservations.Owner(node.nCell, node.nTime+1) == nOwner) continue;
+
+      if (setClosed.count((static_cast<uint64_t>(nAdj) << 8) | (node.nTime+1))) continue;
+
+      sSpaceTimeNode next = {nAdj, node.nTime+1, node.nCost+1, nNode};
+      vecNodes.push_back(next);
+      OpenNodes.push(std::make_pair((next.nCost + Distance(agent, nAdj))*(nWindow+1) + nWindow-next.nTime,
+                                    static_cast<int>(vecNodes.size()-1)));
+    }
+  }
+
+  if (nBest < 0)
+  {
+    // boxed in, stay put, which collides with whoever planned to pass through the cell
+    for (int t=0; t<=nWindow; ++t)
+    {
+      agent.vecPlan[t] = agent.nCell;
+      if (!Reservations.Reserve(agent.nCell, t, nAgent)) agent.bConflict = true;
+    }
+    return false;
+  }
+
+  // wait at the target for the rest of the window
+  for (int t=vecNodes[nBest].nTime+1; t<=nWindow; ++t)
+  {
+    agent.vecPlan[t] = agent.nTarget;
+    if (!Reservations.Reserve(agent.nTarget, t, nAgent)) agent.bConflict = true;
+  }
+
+  for (int nNode = nBest; nNode >= 0; nNode = vecNodes[nNode].nParent)
+  {
+    agent.vecPlan[vecNodes[nNode].nTime] = vecNodes[nNode].nCell;
+    if (!Reservations.Reserve(vecNodes[nNode].nCell, vecNodes[nNode].nTime, nAgent)) agent.bConflict = true;
+  }
+  return true;
+}
+
+
+bool cCooperativePlanner::IsTargetFree(const int nAgent, const int nCell, const int nTime)
+{
+  for (int t=nTime+1; t<=nWindow; ++t)
+  {
+    int nOwner = Reservations.Owner(nCell, t);
+    if (nOwner >= 0 && nOwner != nAgent) return false;
+  }
+  return true;
+}
+
+
+void cCooperativePlanner::FindDistances(sAgent& agent)
+{
+  ++nDistanceSearches;
+  vecPathBuffer.resize(nMapWidth*nMapHeight);
+
+  // the search runs backwards, so its DistanceMap holds the distances to the target
+  cPathfinderWorker* worker = new cPathfinderWorker();
+  int nResult = worker->FindPath(agent.nTarget % nMapWidth, agent.nTarget / nMapWidth,
+                                 agent.nCell % nMapWidth, agent.nCell / nMapWidth,
+                                 pMap, nMapWidth, nMapHeight,
+                                 vecPathBuffer.data(), vecPathBuffer.size());
+
+  agent.vecDistances.clear();
+  agent.nMaxDistance = 0;
+  for (auto& it : worker->getDistanceMap())
+  {
+    agent.vecDistances.push_back(std::make_pair(it.first.second*nMapWidth+it.first.first, it.second));
+    agent.nMaxDistance = std::max(agent.nMaxDistance, it.second);
+  }
+  std::sort(agent.vecDistances.begin(), agent.vecDistances.end());
+  agent.vecDistances.shrink_to_fit();
+
+  // no point in searching again, the target stays out of reach
+  agent.bUnreachable = nResult < 0;
+
+  delete worker;
+}
+
+
+unsigned int cCooperativePlanner::Distance(const sAgent& agent, const int nCell)
+{
+  auto it = std::lower_bound(agent.vecDistances.begin(), agent.vecDistances.end(),
+                             std::make_pair(nCell, 0u));
+  if (it != agent.vecDistances.end() && it->first == nCell) return it->second;
+
+  // the search stops within the layer of the agent, every layer before it is complete
+  return agent.nMaxDistance;
+}
@@ -0,0 +1,314 @@
+#include "FrontierSearch.h"
+
+#include <cstdio>
+#include <algorithm>
+
+
+cFrontierSearchWorker::cFrontierSearchWorker()
+{
+}
+
+cFrontierSearchWorker::~cFrontierSearchWorker()
+{
+}
+
+void cFrontierSearchWorker::UseMemoryLimit(size_t _nMemoryLimitBytes)
+{
+  nMemoryLimitBytes = _nMemoryLimitBytes;
+}
+
+void cFrontierSearchWorker::UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed)
+{
+  pPreprocessed = _pPreprocessed;
+}
+
+
+int cFrontierSearchWorker::FindPath(const int nStartX, const int nStartY,
+                                    const int nTargetX, const int nTargetY,
+                                    const unsigned char* _pMap,
+                                    const int _nMapWidth, const int _nMapHeight,
+                                    int* _pOutBuffer, const int nOutBufferSize)
+{
+  pMap       = _pMap;
+  nMapWidth  = _nMapWidth;
+  nMapHeight = _nMapHeight;
+  pOutBuffer = _pOutBuffer;
+
+  nPeakMemoryBytes = 0;
+  nNodesExpanded   = 0;
+  bMemoryExceeded  = false;
+
+  int nStart  = nStartY*nMapWidth+nStartX;
+  int nTarget = nTargetY*nMapWidth+nTargetX;
+
+  vecDeadEndExits.clear();
+  if (pPreprocessed)
+  {
+    pPreprocessed->DeadEndExit(nStart, vecDeadEndExits);
+    pPreprocessed->DeadEndExit(nTarget, vecDeadEndExits);
+    std::sort(vecDeadEndExits.begin(), vecDeadEndExits.end());
+  }
+
+  int nMeet = -1;
+  int nMeetDepth = 0;
+
+  // the first pass only tells us the length of the path and one node in its middle
+  nPathLength = Meet(nStart, nTarget, nOutBufferSize, nMeet, nMeetDepth);
+
+  // the rest is filled in by solving both halves separately
+  bool bPathFound = nPathLength >= 0 &&
+                    Solve(nStart, nMeet, 0, nMeetDepth) &&
+                    Solve(nMeet, nTarget, nMeetDepth, nPathLength-nMeetDepth);
+
+  // layers are only kept for the duration of the query
+  std::vector<int>().swap(vecFromPrev);
+  std::vector<int>().swap(vecFromCurr);
+  std::vector<int>().swap(vecToPrev);
+  std::vector<int>().swap(vecToCurr);
+  std::vector<int>().swap(vecNext);
+  std::vector<unsigned char>().swap(vecBox);
+  std::vector<int>().swap(vecDeadEndExits);
+
+  if (bMemoryExceeded) printf("Memory limit of %zu bytes exceeded\n", nMemoryLimitBytes);
+  printf("Result: %s, Nodes Expanded %zu, Peak memory %zu bytes\n",
+         bPathFound ? "true" : "false", nNodesExpanded, nPeakMemoryBytes);
+
+  return bPathFound ? nPathLength : -1;
+}
+
+
+int cFrontierSearchWorker::Meet(const int nFrom, const int nTo, const int nMaxDepth,
+                                int& nMeet, int& nMeetDepth)
+{
+  vecFromPrev.clear();
+  vecFromCurr.assign(1, nFrom);
+  vecToPrev.clear();
+  vecToCurr.assign(1, nTo);
+
+  nMeet = nFrom;
+  nMeetDepth = 0;
+  if (nFrom == nTo) return 0;
+
+  int nFromDepth = 0;
+  int nToDepth   = 0;
+
+  while (nFromDepth + nToDepth < nMaxDepth)
+  {
+    // Advance the waves in turns so that they meet halfway
+    bool bFromSide = nFromDepth <= nToDepth;
+    std::vector<int>& vecPrev  = bFromSide ? vecFromPrev : vecToPrev;
+    std::vector<int>& vecCurr  = bFromSide ? vecFromCurr : vecToCurr;
+    std::vector<int>& vecOther = bFromSide ? vecToCurr   : vecFromCurr;
+
+    if (!Expand(vecPrev, vecCurr, vecNext)) return -1;
+
+    // wave has nowhere else to go, there is no path
+    if (vecNext.empty()) return -1;
+
+    vecPrev.swap(vecCurr);
+    vecCurr.swap(vecNext);
+    vecNext.clear();
+
+    if (bFromSide) ++nFromDepth;
+    else ++nToDepth;
+
+    // both layers are sorted, so the first common node is found in a single pass
+    auto itCurr  = vecCurr.begin();
+    auto itOther = vecOther.begin();
+    while (itCurr != vecCurr.end() && itOther != vecOther.end())
+    {
+      if (*itCurr < *itOther) ++itCurr;
+      else if (*itOther < *itCurr) ++itOther;
+      else
+      {
+        nMeet = *itCurr;
+        nMeetDepth = nFromDepth;
+        return nFromDepth + nToDepth;
+      }
+    }
+  }
+
+  // path is longer than the caller is willing to accept
+  return -1;
+}
+
+
+bool cFrontierSearchWorker::Expand(std::vector<int>& vecPrev, std::vector<int>& vecCurr,
+                                   std::vector<int>& vecNext)
+{
+  vecNext.clear();
+
+  for (auto& nNode : vecCurr)
+  {
+    int nCurrX = nNode % nMapWidth;
+    int nCurrY = nNode / nMapWidth;
+    ++nNodesExpanded;
+
+    for (int i=0; i<4; ++i)
+    {
+      int nAdjX = nCurrX+DIR[i].first;
+      int nAdjY = nCurrY+DIR[i].second;
+
+      if (!IsTraversable(nAdjX, nAdjY)) continue;
+
+      // every neighbour of the current layer is either in the previous,
+      // the current or the next one, so there is no need for a closed set
+      int nAdj = nAdjY*nMapWidth+nAdjX;
+      if (std::binary_search(vecPrev.begin(), vecPrev.end(), nAdj) ||
+          std::binary_search(vecCurr.begin(), vecCurr.end(), nAdj)) continue;
+
+      // nodes reached from two sides are added twice, the duplicates are dropped
+      // first and the layer only grows when that frees less than a quarter of it
+      if (vecNext.size() == vecNext.capacity())
+      {
+        std::sort(vecNext.begin(), vecNext.end());
+        vecNext.erase(std::unique(vecNext.begin(), vecNext.end()), vecNext.end());
+
+        if (4*vecNext.size() >= 3*vecNext.capacity())
+        {
+          // the old and the new block are both held while the layer is moved
+          size_t nCapacity = std::max<size_t>(vecNext.capacity() + vecNext.capacity()/2, 16);
+          if (!CheckMemory(nCapacity*sizeof(int))) return false;
+          vecNext.reserve(nCapacity);
+        }
+      }
+
+      vecNext.push_back(nAdj);
+    }
+  }
+
+  std::sort(vecNext.begin(), vecNext.end());
+  vecNext.erase(std::unique(vecNext.begin(), vecNext.end()), vecNext.end());
+
+  return CheckMemory(0);
+}
+
+
+bool cFrontierSearchWorker::Solve(const int nFrom, const int nTo,
+                                  const int nDepth, const int nLength)
+{
+  if (nLength == 0) return true;
+
+  // the box of a direct solve and its queue have to fit into the limit, shorter segments
+  // have smaller boxes, a single step always fits
+  size_t nBoxCells = (2*nLength+1)*(2*nLength+1);
+  if (nLength == 1 || (nLength <= nDirectSolveLength &&
+                       AllocatedBytes() + nBoxCells*(1+sizeof(int)) <= nMemoryLimitBytes))
+  {
+    return SolveDirect(nFrom, nTo, nDepth, nLength);
+  }
+
+  int nMeet = -1;
+  int nMeetDepth = 0;
+
+  // the layers are reused by the recursive calls, so memory does not pile up
+  if (Meet(nFrom, nTo, nLength, nMeet, nMeetDepth) != nLength) return false;
+
+  return Solve(nFrom, nMeet, nDepth, nMeetDepth) &&
+         Solve(nMeet, nTo, nDepth+nMeetDepth, nLength-nMeetDepth);
+}
+
+
+bool cFrontierSearchWorker::SolveDirect(const int nFrom, const int nTo,
+                                        const int nDepth, const int nLength)
+{
+  int nFromX = nFrom % nMapWidth;
+  int nFromY = nFrom / nMapWidth;
+
+  // a shortest path of nLength steps never leaves this box
+  int nBoxX = std::max(0, nFromX-nLength);
+  int nBoxY = std::max(0, nFromY-nLength);
+  int nBoxWidth  = std::min(nMapWidth-1,  nFromX+nLength) - nBoxX + 1;
+  int nBoxHeight = std::min(nMapHeight-1, nFromY+nLength) - nBoxY + 1;
+
+  // distances within the box, 0xFF marks unvisited nodes. Only the bytes the box
+  // adds to what is already allocated are charged, CheckMemory counts the rest
+  vecNext.clear();
+  size_t nBoxBytes = nBoxWidth*nBoxHeight;
+  if (!CheckMemory(nBoxBytes > vecBox.capacity() ? nBoxBytes - vecBox.capacity() : 0)) return false;
+  vecBox.assign(nBoxWidth*nBoxHeight, 0xFF);
+
+  auto BoxIndex = [&](int nX, int nY){ return (nY-nBoxY)*nBoxWidth+(nX-nBoxX); };
+
+  vecBox[BoxIndex(nFromX, nFromY)] = 0;
+  vecNext.push_back(nFrom);
+
+  for (size_t nHead = 0; nHead < vecNext.size(); ++nHead)
+  {
+    int nNode = vecNext[nHead];
+    if (nNode == nTo) break;
+
+    int nCurrX = nNode % nMapWidth;
+    int nCurrY = nNode / nMapWidth;
+    unsigned char nStep = vecBox[BoxIndex(nCurrX, nCurrY)] + 1;
+    if (nStep > nLength) continue;
+    ++nNodesExpanded;
+
+    for (int i=0; i<4; ++i)
+    {
+      int nAdjX = nCurrX+DIR[i].first;
+      int nAdjY = nCurrY+DIR[i].second;
+
+      if (nAdjX < nBoxX || nAdjX >= nBoxX+nBoxWidth ||
+          nAdjY < nBoxY || nAdjY >= nBoxY+nBoxHeight) continue;
+      if (!IsTraversable(nAdjX, nAdjY) || vecBox[BoxIndex(nAdjX, nAdjY)] != 0xFF) continue;
+
+      // account for the reallocation before it happens
+      if (vecNext.size() == vecNext.capacity() &&
+          !CheckMemory(std::max<size_t>(vecNext.capacity(), 1)*sizeof(int))) return false;
+
+      vecBox[BoxIndex(nAdjX, nAdjY)] = nStep;
+      vecNext.push_back(nAdjY*nMapWidth+nAdjX);
+    }
+  }
+
+  int nCurrX = nTo % nMapWidth;
+  int nCurrY = nTo / nMapWidth;
+  if (vecBox[BoxIndex(nCurrX, nCurrY)] != nLength) return false;
+
+  // walk back to nFrom, same output order as cPathfinderWorker::Reconstruct
+  for (int nStep = nLength; nStep > 0; --nStep)
+  {
+    pOutBuffer[nPathLength-(nDepth+nStep)] = nCurrY*nMapWidth+nCurrX;
+
+    for (int i=0; i<4; ++i)
+    {
+      int nAdjX = nCurrX+DIR[i].first;
+      int nAdjY = nCurrY+DIR[i].second;
+
+      if (nAdjX < nBoxX || nAdjX >= nBoxX+nBoxWidth ||
+          nAdjY < nBoxY || nAdjY >= nBoxY+nBoxHeight) continue;
+      if (vecBox[BoxIndex(nAdjX, nAdjY)] == nStep-1)
+      {
+        nCurrX = nAdjX;
+        nCurrY = nAdjY;
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+size_t cFrontierSearchWorker::AllocatedBytes()
+{
+  return (vecFromPrev.capacity() + vecFromCurr.capacity() +
+          vecToPrev.capacity()   + vecToCurr.capacity() +
+          vecNext.capacity()) * sizeof(int) +
+         vecBox.capacity() + vecDeadEndExits.capacity()*sizeof(int);
+}
+
+bool cFrontierSearchWorker::CheckMemory(size_t nExtraBytes)
+{
+  size_t nBytes = AllocatedBytes() + nExtraBytes;
+
+  nPeakMemoryBytes = std::max(nPeakMemoryBytes, nBytes);
+
+  if (nBytes > nMemoryLimitBytes)
+  {
+    bMemoryExceeded = true;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,292 @@
+#include "MapPreprocessor.h"
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+
+cMapPreprocessor::cMapPreprocessor()
+{
+  nThreads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+cMapPreprocessor::~cMapPreprocessor()
+{
+}
+
+void cMapPreprocessor::UseTiles(unsigned int _nTileSize, unsigned int _nThreads)
+{
+  nTileSize = std::max(1u, _nTileSize);
+  nThreads  = std::max(1u, _nThreads);
+}
+
+
+void cMapPreprocessor::Preprocess(const unsigned char* _pMap,
+                                  const int _nMapWidth, const int _nMapHeight)
+{
+  pMap       = _pMap;
+  nMapWidth  = _nMapWidth;
+  nMapHeight = _nMapHeight;
+
+  nTilesX = (nMapWidth  + nTileSize - 1) / nTileSize;
+  nTilesY = (nMapHeight + nTileSize - 1) / nTileSize;
+
+  vecFlags.assign(nMapWidth*nMapHeight, 0);
+  vecDegree.assign(nMapWidth*nMapHeight, 0);
+
+  printf("Preprocessing map in %d tiles on %d threads...", nTilesX*nTilesY, nThreads);
+
+  ForEachTile(&cMapPreprocessor::CountNeighbours);
+
+  // Dead ends that do not touch the tile borders are peeled in parallel
+  ForEachTile(&cMapPreprocessor::PeelTile);
+
+  // whatever is left to peel crosses the borders and is finished in one pass
+  std::vector<int> vecToPeel;
+  for (int i=0; i<nMapWidth*nMapHeight; ++i)
+  {
+    if (pMap[i] == 1 && !(vecFlags[i] & FLAG_DEADEND) && vecDegree[i] <= 1) vecToPeel.push_back(i);
+  }
+
+  while (!vecToPeel.empty())
+  {
+    int nIndex = vecToPeel.back();
+    vecToPeel.pop_back();
+    if ((vecFlags[nIndex] & FLAG_DEADEND) || vecDegree[nIndex] > 1) continue;
+
+    int nExit = Peel(nIndex);
+    if (nExit >= 0 && vecDegree[nExit] <= 1) vecToPeel.push_back(nExit);
+  }
+
+  ForEachTile(&cMapPreprocessor::MarkCorridors);
+
+  // corridors cross the tiles, they are linked up in one pass starting from their ends
+  vecCorridorCells.clear();
+  vecCorridorEnds.clear();
+  for (int i=0; i<nMapWidth*nMapHeight; ++i)
+  {
+    if (!(vecFlags[i] & FLAG_CORRIDOR) || (vecFlags[i] & FLAG_LINKED)) continue;
+
+    for (int j=0; j<4; ++j)
+    {
+      int nAdjX = i % nMapWidth + DIR[j].first;
+      int nAdjY = i / nMapWidth + DIR[j].second;
+      if (!IsTraversable(nAdjX, nAdjY) || (vecFlags[nAdjY*nMapWidth+nAdjX] & FLAG_CORRIDOR)) continue;
+
+      LinkCorridor(nAdjY*nMapWidth+nAdjX, i);
+      break;
+    }
+  }
+  std::sort(vecCorridorEnds.begin(), vecCorridorEnds.end(),
+            [](const sCorridorEnd& a, const sCorridorEnd& b)
+            {return a.nCell < b.nCell || (a.nCell == b.nCell && a.nFrom < b.nFrom);});
+
+  std::vector<unsigned char>().swap(vecDegree);
+
+  nDeadEndCount  = 0;
+  nCorridorCount = 0;
+  for (auto& nFlags : vecFlags)
+  {
+    if (nFlags & FLAG_DEADEND) ++nDeadEndCount;
+    if (nFlags & FLAG_CORRIDOR) ++nCorridorCount;
+  }
+
+  printf("Done\n");
+  printf("Dead end cells: %zu, Corridor cells: %zu, Corridors: %zu\n",
+         nDeadEndCount, nCorridorCount, vecCorridorEnds.size()/2);
+}
+
+
+const cMapPreprocessor::sCorridorEnd* cMapPreprocessor::FindCorridor(const int nFrom, const int nCell) const
+{
+  auto it = std::lower_bound(vecCorridorEnds.begin(), vecCorridorEnds.end(), std::make_pair(nCell, nFrom),
+                             [](const sCorridorEnd& a, const std::pair<int, int>& b)
+                             {return a.nCell < b.first || (a.nCell == b.first && a.nFrom < b.second);});
+
+  if (it == vecCorridorEnds.end() || it->nCell != nCell || it->nFrom != nFrom) return nullptr;
+  return &*it;
+}
+
+
+void cMapPreprocessor::CorridorCells(const sCorridorEnd* pCorridor, int* pCells) const
+{
+  for (int i=0; i<pCorridor->nLength; ++i) pCells[i] = vecCorridorCells[pCorridor->nFirst + i*pCorridor->nStep];
+}
+
+
+void cMapPreprocessor::LinkCorridor(const int nFrom, const int nCell)
+{
+  int nFirst = vecCorridorCells.size();
+  int nPrev  = nFrom;
+  int nCurr  = nCell;
+  int nExit  = -1;
+
+  // a corridor cell has exactly one way forward
+  while (nExit < 0)
+  {
+    vecCorridorCells.push_back(nCurr);
+    vecFlags[nCurr] |= FLAG_LINKED;
+
+    for (int i=0; i<4; ++i)
+    {
+      int nNextX = nCurr % nMapWidth + DIR[i].first;
+      int nNextY = nCurr / nMapWidth + DIR[i].second;
+      int nNext  = nNextY*nMapWidth+nNextX;
+      if (!IsTraversable(nNextX, nNextY) || nNext == nPrev) continue;
+
+      if (vecFlags[nNext] & FLAG_CORRIDOR)
+      {
+        nPrev = nCurr;
+        nCurr = nNext;
+      }
+      else nExit = nNext;
+      break;
+    }
+  }
+
+  int nLength = vecCorridorCells.size() - nFirst;
+  sCorridorEnd front = {nCell, nFrom, nExit, nLength, nFirst, 1, nFirst};
+  sCorridorEnd back  = {nCurr, nExit, nFrom, nLength, nFirst+nLength-1, -1, nFirst};
+  vecCorridorEnds.push_back(front);
+  vecCorridorEnds.push_back(back);
+}
+
+
+void cMapPreprocessor::DeadEndExit(const int nIndex, std::vector<int>& vecExit) const
+{
+  int nCurr = nIndex;
+  while (vecFlags[nCurr] & FLAG_DEADEND)
+  {
+    vecExit.push_back(nCurr);
+    if (!(vecFlags[nCurr] & FLAG_HAS_EXIT)) break;
+
+    auto& dir = DIR[vecFlags[nCurr] & FLAG_EXIT_DIR];
+    nCurr += dir.second*nMapWidth + dir.first;
+  }
+}
+
+
+void cMapPreprocessor::ForEachTile(void (cMapPreprocessor::*Pass)(const int))
+{
+  std::atomic<int> nNextTile(0);
+  int nTiles = nTilesX*nTilesY;
+
+  auto Worker = [&]()
+  {
+    for (int nTile = nNextTile++; nTile < nTiles; nTile = nNextTile++) (this->*Pass)(nTile);
+  };
+
+  std::vector<std::thread> vecWorkers;
+  for (unsigned int i=0; i<nThreads; ++i) vecWorkers.push_back(std::thread(Worker));
+  for (auto& th : vecWorkers) th.join();
+}
+
+
+void cMapPreprocessor::CountNeighbours(const int nTile)
+{
+  int nTileX = (nTile % nTilesX) * nTileSize;
+  int nTileY = (nTile / nTilesX) * nTileSize;
+
+  for (int y=nTileY; y<std::min<int>(nTileY+nTileSize, nMapHeight); ++y)
+  {
+    for (int x=nTileX; x<std::min<int>(nTileX+nTileSize, nMapWidth); ++x)
+    {
+      if (pMap[y*nMapWidth+x] != 1) continue;
+
+      for (int i=0; i<4; ++i)
+      {
+        if (IsTraversable(x+DIR[i].first, y+DIR[i].second)) ++vecDegree[y*nMapWidth+x];
+      }
+    }
+  }
+}
+
+
+void cMapPreprocessor::PeelTile(const int nTile)
+{
+  int nTileX = (nTile % nTilesX) * nTileSize;
+  int nTileY = (nTile / nTilesX) * nTileSize;
+
+  std::vector<int> vecToPeel;
+  for (int y=nTileY; y<std::min<int>(nTileY+nTileSize, nMapHeight); ++y)
+  {
+    for (int x=nTileX; x<std::min<int>(nTileX+nTileSize, nMapWidth); ++x)
+    {
+      if (pMap[y*nMapWidth+x] == 1 && vecDegree[y*nMapWidth+x] <= 1) vecToPeel.push_back(y*nMapWidth+x);
+    }
+  }
+
+  while (!vecToPeel.empty())
+  {
+    int nIndex = vecToPeel.back();
+    vecToPeel.pop_back();
+    if ((vecFlags[nIndex] & FLAG_DEADEND) || vecDegree[nIndex] > 1) continue;
+
+    // Cells next to another tile are left alone, their neighbours
+    // belong to a different thread
+    int nX = nIndex % nMapWidth;
+    int nY = nIndex / nMapWidth;
+    bool bTouchesOtherTile = false;
+    for (int i=0; i<4; ++i)
+    {
+      int nAdjX = nX+DIR[i].first;
+      int nAdjY = nY+DIR[i].second;
+      if (IsTraversable(nAdjX, nAdjY) && TileOf(nAdjX, nAdjY) != nTile) bTouchesOtherTile = true;
+    }
+    if (bTouchesOtherTile) continue;
+
+    int nExit = Peel(nIndex);
+    if (nExit >= 0 && vecDegree[nExit] <= 1) vecToPeel.push_back(nExit);
+  }
+}
+
+
+void cMapPreprocessor::MarkCorridors(const int nTile)
+{
+  int nTileX = (nTile % nTilesX) * nTileSize;
+  int nTileY = (nTile / nTilesX) * nTileSize;
+
+  for (int y=nTileY; y<std::min<int>(nTileY+nTileSize, nMapHeight); ++y)
+  {
+    for (int x=nTileX; x<std::min<int>(nTileX+nTileSize, nMapWidth); ++x)
+    {
+      int nIndex = y*nMapWidth+x;
+      if (pMap[nIndex] != 1 || (vecFlags[nIndex] & FLAG_DEADEND)) continue;
+
+      // dead end regions hang off junctions, so only cells with exactly
+      // two traversable neighbours are part of a corridor
+      int nNeighbours = 0;
+      for (int i=0; i<4; ++i)
+      {
+        if (IsTraversable(x+DIR[i].first, y+DIR[i].second)) ++nNeighbours;
+      }
+      if (nNeighbours == 2) vecFlags[nIndex] |= FLAG_CORRIDOR;
+    }
+  }
+}
+
+
+int cMapPreprocessor::Peel(const int nIndex)
+{
+  int nX = nIndex % nMapWidth;
+  int nY = nIndex / nMapWidth;
+
+  vecFlags[nIndex] |= FLAG_DEADEND;
+
+  for (int i=0; i<4; ++i)
+  {
+    int nAdjX = nX+DIR[i].first;
+    int nAdjY = nY+DIR[i].second;
+    int nAdj  = nAdjY*nMapWidth+nAdjX;
+
+    if (IsTraversable(nAdjX, nAdjY) && !(vecFlags[nAdj] & FLAG_DEADEND))
+    {
+      // the only neighbour left is the way out of this dead end
+      vecFlags[nIndex] |= FLAG_HAS_EXIT | i;
+      --vecDegree[nAdj];
+      return nAdj;
+    }
+  }
+  return -1;
+}
@@ -1,4 +1,8 @@
 #include "Pathfinder.h"
+#include "FrontierSearch.h"
+#include "MapPreprocessor.h"
+
+#include <queue>
 
 
 cPathfinderWorker::cPathfinderWorker()
@@ -16,6 +20,17 @@ cPathfinder::cPathfinder(bool _bUseMultipleThreads=false,
   bUseManhattanBbox   = _bUseManhattanBbox;
 }
 
+void cPathfinder::UseMemoryLimit(bool _bUseMemoryLimit, size_t _nMemoryLimitBytes)
+{
+  bUseMemoryLimit   = _bUseMemoryLimit;
+  nMemoryLimitBytes = _nMemoryLimitBytes;
+}
+
+void cPathfinder::UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed)
+{
+  pPreprocessed = _pPreprocessed;
+}
+
 
 int cPathfinder::FindPath(const int nStartX, const int nStartY,
                           const int nTargetX, const int nTargetY,
@@ -24,6 +39,7 @@ int cPathfinder::FindPath(const int nStartX, const int nStartY,
                           int* pOutBuffer, const int nOutBufferSize)
 {
   nResult = 0;
+  bMemoryExceeded = false;
   
   if (bUseMultipleThreads)
   {
@@ -144,6 +160,19 @@ int cPathfinder::FindPath(const int nStartX, const int nStartY,
     }
     
   }
+  else if (bUseMemoryLimit)
+  {
+    // Singlethreaded memory bounded implementation
+    cFrontierSearchWorker* worker = new cFrontierSearchWorker();
+    worker->UseMemoryLimit(nMemoryLimitBytes);
+    worker->UsePreprocessedMap(pPreprocessed);
+
+    nResult = worker->FindPath(nStartX, nStartY, nTargetX, nTargetY,
+                               pMap, nMapWidth, nMapHeight,
+                               pOutBuffer, nOutBufferSize);
+    bMemoryExceeded = worker->isMemoryExceeded();
+    delete worker;
+  }
   else
   {
     // Singlethreaded implementation
@@ -153,10 +182,12 @@ int cPathfinder::FindPath(const int nStartX, const int nStartY,
     {
       worker->UseManhattanBBox(true, 3);
     }
+    worker->UsePreprocessedMap(pPreprocessed);
     
     nResult = worker->FindPath(nStartX, nStartY, nTargetX, nTargetY,
                               pMap, nMapWidth, nMapHeight,
                               pOutBuffer, nOutBufferSize);
+    delete worker;
   }
   
   return nResult;
@@ -174,7 +205,7 @@ int cPathfinderWorker::FindPath(const int nStartX, const int nStartY,
 
     if (!bUseMultipleThreads)
     {
-      bKeepSearching = new bool;
+      bKeepSearching = &bKeepSearchingAlone;
     }
 
     // if search succeeds, we reconstruct the path and return its length to the caller
@@ -203,6 +234,11 @@ void cPathfinderWorker::UseManhattanBBox(bool _bUseManhattanBbox, unsigned int _
   nMDWindowSize     = _nMDWindowSize;
 }
 
+void cPathfinderWorker::UsePreprocessedMap(const cMapPreprocessor* _pPreprocessed)
+{
+  pPreprocessed = _pPreprocessed;
+}
+
 bool cPathfinderWorker::Search(const int nStartX, const int nStartY,
                         const int nTargetX, const int nTargetY,
                         const unsigned char* pMap,
@@ -214,8 +250,37 @@ bool cPathfinderWorker::Search(const int nStartX, const int nStartY,
 
   nMapHeight = _nMapHeight;
   nMapWidth  = _nMapWidth;
+  this->pMap = pMap;
+
+  nStartIndex  = nStartY*nMapWidth+nStartX;
+  nTargetIndex = nTargetY*nMapWidth+nTargetX;
+  nNodesExpanded = 0;
+  nCorridorCellsWalked = 0;
+
+  // the only dead ends worth entering are the ones holding the start or target
+  vecDeadEndExits.clear();
+  if (pPreprocessed)
+  {
+    pPreprocessed->DeadEndExit(nStartIndex, vecDeadEndExits);
+    pPreprocessed->DeadEndExit(nTargetIndex, vecDeadEndExits);
+    std::sort(vecDeadEndExits.begin(), vecDeadEndExits.end());
+
+    nStartCorridor  = CorridorOf(nStartIndex);
+    nTargetCorridor = CorridorOf(nTargetIndex);
+  }
   
   std::deque<Node> NodesToVisit;
+
+  // Corridor jumps are longer than one step, so with a preprocessed map
+  // the nodes are visited in the order of their distance instead
+  typedef std::pair<unsigned int, Node> OrderedNode;
+  std::priority_queue<OrderedNode, std::vector<OrderedNode>, std::greater<OrderedNode> > OrderedNodesToVisit;
+
+  auto Visit = [&](const Node& node, unsigned int nStep)
+  {
+    if (pPreprocessed) OrderedNodesToVisit.push(std::make_pair(nStep, node));
+    else if (static_cast<int>(nStep)+1<=nOutBufferSize) NodesToVisit.push_back(node);
+  };
       
   unsigned int nStepCounter = 0;
   
@@ -223,13 +288,34 @@ bool cPathfinderWorker::Search(const int nStartX, const int nStartY,
   unsigned int nMDStartEnd = std::abs(nTargetX-nStartX) + std::abs(nTargetY-nStartY);
 
   DistanceMap.insert(std::make_pair(Node(nStartX,nStartY), nStepCounter));
-  NodesToVisit.push_back(Node(nStartX,nStartY));
+  Visit(Node(nStartX,nStartY), nStepCounter);
 
   // iterate until we are out of nodes within reach or path is found or we are told to stop
-  while (!NodesToVisit.empty() && !bPathFound && *bKeepSearching)
+  while ((!NodesToVisit.empty() || !OrderedNodesToVisit.empty()) && !bPathFound && *bKeepSearching)
   {
-    Node NodesIter = NodesToVisit.front();
-    NodesToVisit.pop_front();
+    Node NodesIter;
+    if (pPreprocessed)
+    {
+      NodesIter = OrderedNodesToVisit.top().second;
+      unsigned int nQueuedStep = OrderedNodesToVisit.top().first;
+      OrderedNodesToVisit.pop();
+
+      // node has been reached by a shorter way since it was queued
+      if (nQueuedStep > DistanceMap.find(NodesIter)->second) continue;
+
+      // the distance to the target is only final once it leaves the queue
+      if (NodesIter.first == nTargetX && NodesIter.second == nTargetY)
+      {
+        bPathFound = true;
+        continue;
+      }
+    }
+    else
+    {
+      NodesIter = NodesToVisit.front();
+      NodesToVisit.pop_front();
+    }
+    ++nNodesExpanded;
     nStepCounter = DistanceMap.find(NodesIter)->second +1;
     
     // don't proceed in directions that surpass our path size limit
@@ -245,12 +331,16 @@ bool cPathfinderWorker::Search(const int nStartX, const int nStartY,
       nAdjX = nCurrX+DIR[i].first;
       nAdjY = nCurrY+DIR[i].second;
       // Make sure the node is within our map boundaries
-      if ( static_cast<int>(nAdjX) >= 0 && static_cast<int>(nAdjX) <= nMapWidth &&
-          static_cast<int>(nAdjY) >= 0 && static_cast<int>(nAdjY) <= nMapHeight)
+      if ( static_cast<int>(nAdjX) >= 0 && static_cast<int>(nAdjX) < nMapWidth &&
+          static_cast<int>(nAdjY) >= 0 && static_cast<int>(nAdjY) < nMapHeight)
       {
         // Make sure the node is traversable
-        if (pMap[nAdjY*nMapHeight+nAdjX] == 1)
+        if (pMap[nAdjY*nMapWidth+nAdjX] == 1)
         {
+          // Dead ends never lead anywhere unless we start or finish inside them
+          if (pPreprocessed && pPreprocessed->isDeadEnd(nAdjY*nMapWidth+nAdjX) &&
+              !std::binary_search(vecDeadEndExits.begin(), vecDeadEndExits.end(),
+                                  static_cast<int>(nAdjY*nMapWidth+nAdjX))) continue;
           
           // Further limits the range of out search using Manhattan distance to prevent
           // the wave from spreading in all directions infinitely
@@ -271,29 +361,38 @@ bool cPathfinderWorker::Search(const int nStartX, const int nStartY,
             if (nMDAdjEnd <= nMDStartEnd / 2) vecPastManhattan->push_back(Node(nCurrX, nCurrY));
           }
           
+          // Corridors are crossed in a single jump to their far end
+          unsigned int nAdjStep = nStepCounter;
+          if (pPreprocessed)
+          {
+            nAdjStep += JumpCorridor(nCurrX, nCurrY, nAdjX, nAdjY, nullptr);
+            if (static_cast<int>(nAdjStep) > nOutBufferSize) continue;
+          }
+
           // check if we have found our destination
-          if (static_cast<int>(nAdjX) == nTargetX && static_cast<int>(nAdjY) == nTargetY) bPathFound = true;
+          if (!pPreprocessed && static_cast<int>(nAdjX) == nTargetX && static_cast<int>(nAdjY) == nTargetY) bPathFound = true;
                                   
           // Make sure we store the shortest possible path to this node
           auto prevValue = DistanceMap.find(Node(nAdjX,nAdjY));
           if (prevValue != DistanceMap.end())
           {
-            if (prevValue->second > nStepCounter) {
+            if (prevValue->second > nAdjStep) {
               // modify the value and mark this node for revisiting
-              DistanceMap[prevValue->first] = nStepCounter;
-              if (static_cast<int>(nStepCounter)+1<=nOutBufferSize) NodesToVisit.push_back(Node(nAdjX, nAdjY));
+              DistanceMap[prevValue->first] = nAdjStep;
+              Visit(Node(nAdjX, nAdjY), nAdjStep);
             }
           }
           else
           {
-            DistanceMap.insert(std::make_pair(Node(nAdjX,nAdjY), nStepCounter));
-            if (static_cast<int>(nStepCounter)+1<=nOutBufferSize) NodesToVisit.push_back(Node(nAdjX, nAdjY));
+            DistanceMap.insert(std::make_pair(Node(nAdjX,nAdjY), nAdjStep));
+            Visit(Node(nAdjX, nAdjY), nAdjStep);
           }
         }
       }
     }
   } // done iterating over the NodesToVisit
-  printf("Result: %s, Nodes Checked %d\n", bPathFound ? "true" : "false", DistanceMap.size());
+  printf("Result: %s, Nodes Checked %zu, Nodes Expanded %zu, Corridor cells walked %zu\n",
+         bPathFound ? "true" : "false", DistanceMap.size(), nNodesExpanded, nCorridorCellsWalked);
   *bKeepSearching = false;
   return bPathFound;
 }
@@ -315,9 +414,10 @@ int cPathfinderWorker::Reconstruct(const int nTargetX, const int nTargetY, int*
       nCurrX = std::get<0>(itDL->first);
       nCurrY = std::get<1>(itDL->first);
 
-      pOutBuffer[i] = nCurrY*nMapHeight+nCurrX;
+      pOutBuffer[i] = nCurrY*nMapWidth+nCurrX;
 
       auto min = itDL;
+      unsigned int nCurrStep = itDL->second;
 
       // find the lowest adjacent node value
       for (int j=0; j<4; ++j)
@@ -333,6 +433,33 @@ int cPathfinderWorker::Reconstruct(const int nTargetX, const int nTargetY, int*
           if (itDL->second < min->second) min = itDL;
         }
       }
+
+      // no neighbour is a step closer, so we got here by jumping over a corridor
+      if (pPreprocessed && min->second+1 != nCurrStep)
+      {
+        for (int j=0; j<4; ++j)
+        {
+          nAdjX = nCurrX+DIR[j].first;
+          nAdjY = nCurrY+DIR[j].second;
+
+          if (static_cast<int>(nAdjX) < 0 || static_cast<int>(nAdjX) >= nMapWidth ||
+              static_cast<int>(nAdjY) < 0 || static_cast<int>(nAdjY) >= nMapHeight ||
+              !pPreprocessed->isCorridor(nAdjY*nMapWidth+nAdjX)) continue;
+
+          unsigned int nSteps = JumpCorridor(nCurrX, nCurrY, nAdjX, nAdjY, nullptr);
+          auto itEnd = DistanceMap.find(Node(nAdjX,nAdjY));
+          if (itEnd != DistanceMap.end() && itEnd->second+nSteps+1 == nCurrStep)
+          {
+            // same corridor again, this time writing out its cells
+            nAdjX = nCurrX+DIR[j].first;
+            nAdjY = nCurrY+DIR[j].second;
+            JumpCorridor(nCurrX, nCurrY, nAdjX, nAdjY, pOutBuffer+i+1);
+            i += nSteps;
+            min = itEnd;
+            break;
+          }
+        }
+      }
       itDL = min;
     }
   }
@@ -346,5 +473,83 @@ int cPathfinderWorker::Reconstruct(const int nTargetX, const int nTargetY, int*
 }
 
 
+unsigned int cPathfinderWorker::JumpCorridor(unsigned int nFromX, unsigned int nFromY,
+                                             unsigned int& nX, unsigned int& nY, int* pCells)
+{
+  int nIndex = nY*nMapWidth+nX;
+
+  // the preprocessor knows where the corridor leads unless the start or target lies inside
+  auto pCorridor = pPreprocessed->FindCorridor(nFromY*nMapWidth+nFromX, nIndex);
+  if (pCorridor && pCorridor->nCorridor != nStartCorridor && pCorridor->nCorridor != nTargetCorridor)
+  {
+    if (pCells) pPreprocessed->CorridorCells(pCorridor, pCells);
+    nX = pCorridor->nExit % nMapWidth;
+    nY = pCorridor->nExit / nMapWidth;
+    return pCorridor->nLength;
+  }
 
+  unsigned int nSteps = 0;
+
+  // stop at the start and target, they may lie in the middle of a corridor
+  while (pPreprocessed->isCorridor(nIndex) && nIndex != nStartIndex && nIndex != nTargetIndex)
+  {
+    if (pCells) pCells[nSteps] = nIndex;
 
+    // a corridor cell has exactly one way forward
+    for (int i=0; i<4; ++i)
+    {
+      unsigned int nNextX = nX+DIR[i].first;
+      unsigned int nNextY = nY+DIR[i].second;
+
+      if (nNextX == nFromX && nNextY == nFromY) continue;
+      if (static_cast<int>(nNextX) >= 0 && static_cast<int>(nNextX) < nMapWidth &&
+          static_cast<int>(nNextY) >= 0 && static_cast<int>(nNextY) < nMapHeight &&
+          pMap[nNextY*nMapWidth+nNextX] == 1)
+      {
+        nFromX = nX;
+        nFromY = nY;
+        nX = nNextX;
+        nY = nNextY;
+        break;
+      }
+    }
+
+    nIndex = nY*nMapWidth+nX;
+    ++nSteps;
+  }
+  nCorridorCellsWalked += nSteps;
+  return nSteps;
+}
+
+
+int cPathfinderWorker::CorridorOf(const int nIndex)
+{
+  int nPrev = -1;
+  int nCurr = nIndex;
+
+  // walk to either end of the corridor, rings have none
+  while (pPreprocessed->isCorridor(nCurr))
+  {
+    ++nCorridorCellsWalked;
+    for (int i=0; i<4; ++i)
+    {
+      int nNextX = nCurr % nMapWidth + DIR[i].first;
+      int nNextY = nCurr / nMapWidth + DIR[i].second;
+      int nNext  = nNextY*nMapWidth+nNextX;
+      if (nNextX < 0 || nNextX >= nMapWidth || nNextY < 0 || nNextY >= nMapHeight ||
+          pMap[nNext] != 1 || nNext == nPrev) continue;
+
+      if (!pPreprocessed->isCorridor(nNext))
+      {
+        auto pCorridor = pPreprocessed->FindCorridor(nNext, nCurr);
+        return pCorridor ? pCorridor->nCorridor : -1;
+      }
+
+      nPrev = nCurr;
+      nCurr = nNext;
+      break;
+    }
+    if (nCurr == nIndex) return -1;
+  }
+  return -1;
+}
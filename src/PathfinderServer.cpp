@@ -0,0 +1,418 @@
+#include "PathfinderServer.h"
+#include "Pathfinder.h"
+#include "MapPreprocessor.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+// Sockets may return less than asked for, keep going until everything is through
+static bool ReadAll(int nSocket, void* pData, size_t nBytes)
+{
+  char* pCurr = static_cast<char*>(pData);
+  while (nBytes > 0)
+  {
+    ssize_t nRead = recv(nSocket, pCurr, nBytes, 0);
+    if (nRead < 0 && errno == EINTR) continue;
+    if (nRead <= 0) return false;
+    pCurr  += nRead;
+    nBytes -= nRead;
+  }
+  return true;
+}
+
+static bool WriteAll(int nSocket, const void* pData, size_t nBytes)
+{
+  const char* pCurr = static_cast<const char*>(pData);
+  while (nBytes > 0)
+  {
+    // a client that went away must not take the whole server down with SIGPIPE
+    ssize_t nWritten = send(nSocket, pCurr, nBytes, MSG_NOSIGNAL);
+    if (nWritten < 0 && errno == EINTR) continue;
+    if (nWritten <= 0) return false;
+    pCurr  += nWritten;
+    nBytes -= nWritten;
+  }
+  return true;
+}
+
+static bool MakeAddress(const std::string& sSocketPath, sockaddr_un& address)
+{
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (sSocketPath.size() >= sizeof(address.sun_path))
+  {
+    printf("Socket path is too long: %s\n", sSocketPath.c_str());
+    return false;
+  }
+  strncpy(address.sun_path, sSocketPath.c_str(), sizeof(address.sun_path)-1);
+  return true;
+}
+
+
+
+cPathfinderServer::cPathfinderServer(std::string _sSocketPath, std::string _sSharedMemoryName,
+                                     unsigned int _nThreads)
+  : sSocketPath(_sSocketPath), sSharedMemoryName(_sSharedMemoryName), bRunning(false)
+{
+  nThreads = _nThreads > 0 ? _nThreads : 1;
+}
+
+cPathfinderServer::~cPathfinderServer()
+{
+  if (pMap)
+  {
+    munmap(pMap, nMapWidth*nMapHeight);
+    shm_unlink(sSharedMemoryName.c_str());
+  }
+  delete pPreprocessed;
+}
+
+void cPathfinderServer::UsePreprocessing(bool _bUsePreprocessing)
+{
+  bUsePreprocessing = _bUsePreprocessing;
+}
+
+
+bool cPathfinderServer::LoadMap(std::string path, const int _nMapWidth, const int _nMapHeight)
+{
+  nMapWidth  = _nMapWidth;
+  nMapHeight = _nMapHeight;
+  size_t nMapSize = nMapWidth*nMapHeight;
+
+  printf("Loading Map into shared memory %s...", sSharedMemoryName.c_str());
+
+  // Clients only get to read the map. The object is created read-only for everyone,
+  // the descriptor returned here is the only one that can ever write to it
+  int fdMap = shm_open(sSharedMemoryName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0444);
+  if (fdMap < 0)
+  {
+    printf("Failed to create shared memory: %s\n", strerror(errno));
+    return false;
+  }
+
+  void* pShared = MAP_FAILED;
+  if (ftruncate(fdMap, nMapSize) == 0)
+  {
+    pShared = mmap(nullptr, nMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fdMap, 0);
+  }
+  close(fdMap);
+
+  if (pShared == MAP_FAILED)
+  {
+    printf("Failed to map shared memory: %s\n", strerror(errno));
+    shm_unlink(sSharedMemoryName.c_str());
+    return false;
+  }
+  pMap = static_cast<unsigned char*>(pShared);
+
+  std::ifstream inStream(path, std::ios::binary);
+  inStream.read(reinterpret_cast<char*>(pMap), nMapSize);
+  if (static_cast<size_t>(inStream.gcount()) != nMapSize)
+  {
+    printf("Map file is shorter than %zu bytes\n", nMapSize);
+    return false;
+  }
+
+  // nobody is allowed to change the map from now on, including us
+  mprotect(pMap, nMapSize, PROT_READ);
+
+  printf("Done\n");
+  return true;
+}
+
+
+bool cPathfinderServer::Run()
+{
+  if (!pMap)
+  {
+    printf("No map has been loaded\n");
+    return false;
+  }
+
+  if (bUsePreprocessing && !pPreprocessed)
+  {
+    pPreprocessed = new cMapPreprocessor();
+    pPreprocessed->Preprocess(pMap, nMapWidth, nMapHeight);
+  }
+
+  sockaddr_un address;
+  if (!MakeAddress(sSocketPath, address)) return false;
+
+  nListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(sSocketPath.c_str());
+  if (nListenSocket < 0 ||
+      bind(nListenSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(nListenSocket, 64) != 0)
+  {
+    printf("Failed to listen on %s: %s\n", sSocketPath.c_str(), strerror(errno));
+    if (nListenSocket >= 0) close(nListenSocket);
+    return false;
+  }
+
+  printf("Serving %s on %s with %d workers\n", sSharedMemoryName.c_str(), sSocketPath.c_str(), nThreads);
+
+  bRunning = true;
+  bStopWorkers = false;
+
+  std::vector<std::thread> vecWorkers;
+  for (unsigned int i=0; i<nThreads; ++i) vecWorkers.push_back(std::thread(&cPathfinderServer::Work, this));
+
+  while (bRunning)
+  {
+    int nSocket = accept(nListenSocket, nullptr, nullptr);
+    if (nSocket < 0)
+    {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    std::lock_guard<std::mutex> lock(mtxClients);
+    vecClientSockets.push_back(nSocket);
+    std::thread(&cPathfinderServer::ServeClient, this, nSocket).detach();
+  }
+
+  printf("Shutting down...");
+
+  // wake up the clients that wait for their next batch and let them finish
+  {
+    std::unique_lock<std::mutex> lock(mtxClients);
+    for (auto& nSocket : vecClientSockets) shutdown(nSocket, SHUT_RDWR);
+    cvClients.wait(lock, [this]{return vecClientSockets.empty();});
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mtxTasks);
+    bStopWorkers = true;
+  }
+  cvTasks.notify_all();
+  for (auto& th : vecWorkers) th.join();
+
+  close(nListenSocket);
+  unlink(sSocketPath.c_str());
+
+  printf("Done\n");
+  return true;
+}
+
+
+void cPathfinderServer::Stop()
+{
+  bRunning = false;
+  if (nListenSocket >= 0) shutdown(nListenSocket, SHUT_RDWR);
+}
+
+
+void cPathfinderServer::ServeClient(int nSocket)
+{
+  Serve(nSocket);
+
+  std::lock_guard<std::mutex> lock(mtxClients);
+  vecClientSockets.erase(std::find(vecClientSockets.begin(), vecClientSockets.end(), nSocket));
+  close(nSocket);
+  cvClients.notify_all();
+}
+
+
+void cPathfinderServer::Serve(int nSocket)
+{
+  sSharedMapInfo info;
+  memset(&info, 0, sizeof(info));
+  info.nMapWidth  = nMapWidth;
+  info.nMapHeight = nMapHeight;
+  strncpy(info.sSharedMemoryName, sSharedMemoryName.c_str(), sizeof(info.sSharedMemoryName)-1);
+
+  if (!WriteAll(nSocket, &info, sizeof(info))) return;
+
+  unsigned int nQueries = 0;
+  while (bRunning && ReadAll(nSocket, &nQueries, sizeof(nQueries)))
+  {
+    if (nQueries > MAX_BATCH_SIZE)
+    {
+      printf("Client sent a batch of %u queries, disconnecting\n", nQueries);
+      break;
+    }
+
+    std::vector<sPathQuery> vecQueries(nQueries);
+    if (!ReadAll(nSocket, vecQueries.data(), nQueries*sizeof(sPathQuery))) break;
+
+    std::vector<int> vecResults(nQueries, -1);
+    std::vector<std::vector<int> > vecPaths(nQueries);
+
+    sBatch batch;
+    batch.nPending = nQueries;
+
+    {
+      std::lock_guard<std::mutex> lock(mtxTasks);
+      for (unsigned int i=0; i<nQueries; ++i)
+      {
+        sTask task = {&vecQueries[i], &vecResults[i], &vecPaths[i], &batch};
+        Tasks.push_back(task);
+      }
+    }
+    cvTasks.notify_all();
+
+    {
+      std::unique_lock<std::mutex> lock(batch.mtx);
+      batch.cvDone.wait(lock, [&batch]{return batch.nPending == 0;});
+    }
+
+    // reply with the whole batch at once
+    std::vector<int> vecReply;
+    for (unsigned int i=0; i<nQueries; ++i)
+    {
+      vecReply.push_back(vecResults[i]);
+      if (vecResults[i] > 0) vecReply.insert(vecReply.end(), vecPaths[i].begin(), vecPaths[i].begin()+vecResults[i]);
+    }
+    if (!WriteAll(nSocket, vecReply.data(), vecReply.size()*sizeof(int))) break;
+  }
+}
+
+
+void cPathfinderServer::Work()
+{
+  // Every search writes into this buffer, only the nodes of the path are kept for the reply.
+  // It is never initialized, so the pages a path does not reach are never backed by memory
+  int* pOutBuffer = new int[nMapWidth*nMapHeight];
+
+  while (true)
+  {
+    sTask task;
+    {
+      std::unique_lock<std::mutex> lock(mtxTasks);
+      cvTasks.wait(lock, [this]{return !Tasks.empty() || bStopWorkers;});
+      if (Tasks.empty()) break;
+      task = Tasks.front();
+      Tasks.pop_front();
+    }
+
+    const sPathQuery& query = *task.pQuery;
+
+    // never trust coordinates that come over the wire
+    if (query.nStartX  >= 0 && query.nStartX  < nMapWidth && query.nStartY  >= 0 && query.nStartY  < nMapHeight &&
+        query.nTargetX >= 0 && query.nTargetX < nMapWidth && query.nTargetY >= 0 && query.nTargetY < nMapHeight &&
+        query.nOutBufferSize > 0)
+    {
+      int nOutBufferSize = std::min(query.nOutBufferSize, nMapWidth*nMapHeight);
+
+      cPathfinder pf(false, false);
+      pf.UsePreprocessedMap(pPreprocessed);
+      *task.pResult = pf.FindPath(query.nStartX, query.nStartY, query.nTargetX, query.nTargetY,
+                                  pMap, nMapWidth, nMapHeight,
+                                  pOutBuffer, nOutBufferSize);
+      task.pPath->assign(pOutBuffer, pOutBuffer + std::max(*task.pResult, 0));
+    }
+
+    std::lock_guard<std::mutex> lock(task.pBatch->mtx);
+    if (--task.pBatch->nPending == 0) task.pBatch->cvDone.notify_all();
+  }
+
+  delete [] pOutBuffer;
+}
+
+
+
+cPathfinderClient::cPathfinderClient(std::string _sSocketPath)
+  : sSocketPath(_sSocketPath)
+{
+}
+
+cPathfinderClient::~cPathfinderClient()
+{
+  if (nSocket >= 0) close(nSocket);
+  if (pMap) munmap(const_cast<unsigned char*>(pMap), nMapWidth*nMapHeight);
+}
+
+
+bool cPathfinderClient::Connect()
+{
+  sockaddr_un address;
+  if (!MakeAddress(sSocketPath, address)) return false;
+
+  nSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (nSocket < 0 || connect(nSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+  {
+    if (nSocket >= 0) close(nSocket);
+    nSocket = -1;
+    return false;
+  }
+
+  sSharedMapInfo info;
+  if (!ReadAll(nSocket, &info, sizeof(info))) return false;
+  info.sSharedMemoryName[sizeof(info.sSharedMemoryName)-1] = 0;
+
+  int fdMap = shm_open(info.sSharedMemoryName, O_RDONLY, 0);
+  if (fdMap < 0)
+  {
+    printf("Failed to open shared memory %s: %s\n", info.sSharedMemoryName, strerror(errno));
+    return false;
+  }
+
+  void* pShared = mmap(nullptr, info.nMapWidth*info.nMapHeight, PROT_READ, MAP_SHARED, fdMap, 0);
+  close(fdMap);
+  if (pShared == MAP_FAILED)
+  {
+    printf("Failed to map shared memory: %s\n", strerror(errno));
+    return false;
+  }
+
+  pMap       = static_cast<const unsigned char*>(pShared);
+  nMapWidth  = info.nMapWidth;
+  nMapHeight = info.nMapHeight;
+  return true;
+}
+
+
+int cPathfinderClient::FindPath(const int nStartX, const int nStartY,
+                                const int nTargetX, const int nTargetY,
+                                const unsigned char* _pMap,
+                                const int _nMapWidth, const int _nMapHeight,
+                                int* pOutBuffer, const int nOutBufferSize)
+{
+  if ((_pMap != nullptr && _pMap != pMap) || _nMapWidth != nMapWidth || _nMapHeight != nMapHeight)
+  {
+    printf("Query does not match the shared map\n");
+    return -1;
+  }
+
+  std::vector<sPathQuery> vecQueries(1);
+  vecQueries[0].nStartX  = nStartX;
+  vecQueries[0].nStartY  = nStartY;
+  vecQueries[0].nTargetX = nTargetX;
+  vecQueries[0].nTargetY = nTargetY;
+  vecQueries[0].nOutBufferSize = nOutBufferSize;
+
+  std::vector<int*> vecOutBuffers(1, pOutBuffer);
+  std::vector<int> vecResults;
+
+  if (!FindPaths(vecQueries, vecOutBuffers, vecResults)) return -1;
+  return vecResults[0];
+}
+
+
+bool cPathfinderClient::FindPaths(const std::vector<sPathQuery>& vecQueries,
+                                  const std::vector<int*>& vecOutBuffers, std::vector<int>& vecResults)
+{
+  vecResults.assign(vecQueries.size(), -1);
+  if (nSocket < 0) return false;
+
+  unsigned int nQueries = vecQueries.size();
+  if (!WriteAll(nSocket, &nQueries, sizeof(nQueries)) ||
+      !WriteAll(nSocket, vecQueries.data(), nQueries*sizeof(sPathQuery))) return false;
+
+  for (unsigned int i=0; i<nQueries; ++i)
+  {
+    if (!ReadAll(nSocket, &vecResults[i], sizeof(int))) return false;
+    if (vecResults[i] > 0 && !ReadAll(nSocket, vecOutBuffers[i], vecResults[i]*sizeof(int))) return false;
+  }
+  return true;
+}
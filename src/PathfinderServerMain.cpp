@@ -0,0 +1,54 @@
+/* Author: Vladimir Korshak (c) 2014
+* Indentaion: 2 Characters
+* Standard: C++11
+* Compiler: GCC 4.8
+* Compilation: make PathfinderServer
+* Run: ./PathfinderServer map_file width height [socket_path] [threads] [preprocess]
+*/
+
+#include "PathfinderServer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+
+
+cPathfinderServer* pServer = nullptr;
+
+void StopServer(int)
+{
+  if (pServer) pServer->Stop();
+}
+
+
+int main(int argc, const char* argv[])
+{
+  if (argc < 4)
+  {
+    printf("Usage: %s map_file width height [socket_path] [threads] [preprocess]\n", argv[0]);
+    return 1;
+  }
+
+  std::string path       = argv[1];
+  int nMapWidth          = atoi(argv[2]);
+  int nMapHeight         = atoi(argv[3]);
+  std::string sSocket    = argc > 4 ? argv[4] : "/tmp/pathfinder.sock";
+  unsigned int nThreads  = argc > 5 ? atoi(argv[5]) : std::thread::hardware_concurrency();
+  bool bUsePreprocessing = argc > 6 && atoi(argv[6]) != 0;
+
+  // one shared map per server process
+  std::string sSharedMemory = "/pathfinder_map_" + std::to_string(getpid());
+
+  pServer = new cPathfinderServer(sSocket, sSharedMemory, nThreads);
+  pServer->UsePreprocessing(bUsePreprocessing);
+
+  signal(SIGINT,  StopServer);
+  signal(SIGTERM, StopServer);
+
+  int nResult = 1;
+  if (pServer->LoadMap(path, nMapWidth, nMapHeight) && pServer->Run()) nResult = 0;
+
+  delete pServer;
+  return nResult;
+}
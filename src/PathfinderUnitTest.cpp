@@ -7,10 +7,22 @@
 */
 
 #include "Pathfinder.h"
+#include "FrontierSearch.h"
+#include "MapPreprocessor.h"
+#include "PathfinderServer.h"
+#include "CooperativePlanner.h"
 
 #include <iostream>
 #include <fstream>
 
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+
 /* Task description
 Implement a path-finding algorithm in C++ that finds and outputs a shortest path
 between start and target using the following function declaration:
@@ -114,6 +126,57 @@ void GenerateRandomMap(const unsigned int nStartX, const unsigned int nStartY,
 }
 
 
+void GenerateMazeMap(unsigned char* Map, const unsigned int nMapWidth, const unsigned int nMapHeight,
+                     const unsigned int nLoops, const unsigned int nSeed)
+{
+  // carve a perfect maze with a randomized depth-first walk over the odd cells
+  for (unsigned int i=0; i<nMapWidth*nMapHeight; ++i) Map[i] = 0;
+
+  // the same seed gives the same maze, so benchmark runs can be compared
+  srand (nSeed);
+  std::vector<unsigned int> vecStack;
+  Map[nMapWidth+1] = 1;
+  vecStack.push_back(nMapWidth+1);
+
+  int DIR[4][2] = {{2,0}, {-2,0}, {0,2}, {0,-2}};
+  while (!vecStack.empty())
+  {
+    int nX = vecStack.back() % nMapWidth;
+    int nY = vecStack.back() / nMapWidth;
+
+    int nFirst = rand() % 4;
+    bool bCarved = false;
+    for (int i=0; i<4 && !bCarved; ++i)
+    {
+      int nNextX = nX + DIR[(nFirst+i)%4][0];
+      int nNextY = nY + DIR[(nFirst+i)%4][1];
+      if (nNextX < 1 || nNextY < 1 ||
+          nNextX >= static_cast<int>(nMapWidth)-1 || nNextY >= static_cast<int>(nMapHeight)-1 ||
+          Map[nNextY*nMapWidth+nNextX] == 1) continue;
+
+      Map[((nY+nNextY)/2)*nMapWidth+(nX+nNextX)/2] = 1;
+      Map[nNextY*nMapWidth+nNextX] = 1;
+      vecStack.push_back(nNextY*nMapWidth+nNextX);
+      bCarved = true;
+    }
+    if (!bCarved) vecStack.pop_back();
+  }
+
+  // knock out some walls so that there is more than one way around, only the ones
+  // between two corridors, a pillar knocked out on its own might end up cut off
+  for (unsigned int i=0; i<nLoops; ++i)
+  {
+    unsigned int nX, nY;
+    do
+    {
+      nX = 1 + rand() % (nMapWidth-2);
+      nY = 1 + rand() % (nMapHeight-2);
+    } while ((nX + nY) % 2 == 0);
+    Map[nY*nMapWidth+nX] = 1;
+  }
+}
+
+
 void UnitTest_LoadSaveMap()
 {
   printf("\n\n~~~ Load Save Unit test ~~~ \n");
@@ -269,6 +332,753 @@ void UnitTest_Pathfinder(std::string path, unsigned int nMapSizeBytes,
 }
 
 
+// Checks a path in the order FindPath writes it: from the target back to the node next to the start,
+// every step to an adjacent traversable node
+bool IsValidPath(const unsigned char* pMap, unsigned int nMapWidth, unsigned int nMapHeight,
+                 unsigned int nStartX, unsigned int nStartY,
+                 unsigned int nTargetX, unsigned int nTargetY,
+                 const int* pPath, int nLength)
+{
+  if (nLength <= 0) return nLength == 0 && nStartX == nTargetX && nStartY == nTargetY;
+  if (pPath[0] != static_cast<int>(nTargetY*nMapWidth+nTargetX)) return false;
+
+  for (int i=0; i<=nLength; ++i)
+  {
+    int nCell = (i < nLength) ? pPath[i] : nStartY*nMapWidth+nStartX;
+    if (nCell < 0 || nCell >= static_cast<int>(nMapWidth*nMapHeight) || pMap[nCell] != 1) return false;
+    if (i == 0) continue;
+
+    int nPrev = pPath[i-1];
+    int nDistance = std::abs(nCell % static_cast<int>(nMapWidth) - nPrev % static_cast<int>(nMapWidth)) +
+                    std::abs(nCell / static_cast<int>(nMapWidth) - nPrev / static_cast<int>(nMapWidth));
+    if (nDistance != 1) return false;
+  }
+  return true;
+}
+
+
+void UnitTest_MemoryBounded(std::string path, unsigned int nMapSizeBytes,
+                            unsigned int nOutBufferSize, size_t nMemoryLimitBytes)
+{
+    unsigned int nMapWidth = std::floor(std::sqrt(nMapSizeBytes));
+    unsigned int nMapHeight = nMapWidth;
+
+    unsigned int nStartX = 0;
+    unsigned int nStartY = 0;
+    unsigned int nTargetX = nMapWidth-1;
+    unsigned int nTargetY = nMapHeight-1;
+
+    printf("\n~~~ UnitTest_MemoryBounded ~~~ \n");
+    printf("Map filename: %s\n", path.c_str());
+    printf("Map dimemsions: %dx%d\n", nMapWidth, nMapHeight);
+    printf("Start (%d,%d)    Target (%d,%d)\n", nStartX, nStartY, nTargetX, nTargetY);
+    printf("Memory limit: %zu bytes\n", nMemoryLimitBytes);
+
+    unsigned char* pMap;
+    int* OutBuffer;
+
+    try
+    {
+      printf("Allocating memory...");
+      pMap = new unsigned char[nMapWidth*nMapHeight];
+      OutBuffer = new int[nOutBufferSize];
+      printf("Done\n");
+    }
+    catch (std::bad_alloc& ba)
+    {
+      printf("The program is not able to allocate that much memory: %s\n", ba.what());
+      abort();
+    }
+
+    LoadMapFromFile(path, pMap, nMapSizeBytes);
+
+    // Every search runs in its own child process so that its peak memory usage
+    // can be measured separately. Both figures include the shared map itself.
+    int nResults[2];
+    long nPeakKb[2];
+    const char* sEngines[2] = {"Search", "Frontier search"};
+
+    for (int nEngine=0; nEngine<2; ++nEngine)
+    {
+      printf("Starting the search...%s\n", sEngines[nEngine]);
+      fflush(stdout);
+
+      int fdResult[2];
+      if (pipe(fdResult) != 0) abort();
+
+      pid_t pid = fork();
+      if (pid == 0)
+      {
+        cPathfinder* pf = new cPathfinder(false, false);
+        if (nEngine == 1) pf->UseMemoryLimit(true, nMemoryLimitBytes);
+
+        auto start = std::chrono::system_clock::now();
+
+        int nResult = pf->FindPath(nStartX, nStartY, nTargetX, nTargetY,
+                                   pMap, nMapWidth, nMapHeight,
+                                   OutBuffer, nOutBufferSize);
+
+        auto end = std::chrono::system_clock::now();
+
+        printf("Execution time: %lld milliseconds\n",
+              std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+        if (pf->isMemoryExceeded()) printf("Gave up at the memory limit, the path may still exist\n");
+        fflush(stdout);
+
+        // the path follows the result so that the parent can check it
+        if (write(fdResult[1], &nResult, sizeof(nResult)) != sizeof(nResult)) _exit(1);
+        for (size_t nSent = 0; nResult > 0 && nSent < nResult*sizeof(int); )
+        {
+          ssize_t nWritten = write(fdResult[1], reinterpret_cast<char*>(OutBuffer)+nSent,
+                                   nResult*sizeof(int)-nSent);
+          if (nWritten <= 0) _exit(1);
+          nSent += nWritten;
+        }
+        _exit(0);
+      }
+
+      close(fdResult[1]);
+      nResults[nEngine] = -1;
+      if (read(fdResult[0], &nResults[nEngine], sizeof(int)) != sizeof(int)) nResults[nEngine] = -1;
+
+      bool bPathValid = nResults[nEngine] >= 0;
+      for (size_t nReceived = 0; nResults[nEngine] > 0 && nReceived < nResults[nEngine]*sizeof(int); )
+      {
+        ssize_t nRead = read(fdResult[0], reinterpret_cast<char*>(OutBuffer)+nReceived,
+                             nResults[nEngine]*sizeof(int)-nReceived);
+        if (nRead <= 0)
+        {
+          bPathValid = false;
+          break;
+        }
+        nReceived += nRead;
+      }
+      close(fdResult[0]);
+
+      bPathValid = bPathValid && IsValidPath(pMap, nMapWidth, nMapHeight, nStartX, nStartY,
+                                             nTargetX, nTargetY, OutBuffer, nResults[nEngine]);
+      if (nResults[nEngine] >= 0) printf("Path %s\n", bPathValid ? "is valid" : "IS NOT VALID");
+
+      int nStatus;
+      struct rusage usage;
+      wait4(pid, &nStatus, 0, &usage);
+      nPeakKb[nEngine] = usage.ru_maxrss;
+
+      printf("Path length: %d, Peak resident memory: %ld kb\n", nResults[nEngine], nPeakKb[nEngine]);
+    }
+
+    printf("Path lengths %s\n", nResults[0] == nResults[1] ? "match" : "DO NOT MATCH");
+
+    delete [] OutBuffer;
+    delete [] pMap;
+}
+
+
+void UnitTest_Preprocessing(std::string sName, const unsigned char* pMap,
+                            unsigned int nMapWidth, unsigned int nMapHeight,
+                            unsigned int nStartX, unsigned int nStartY,
+                            unsigned int nTargetX, unsigned int nTargetY,
+                            unsigned int nOutBufferSize)
+{
+    printf("\n~~~ UnitTest_Preprocessing ~~~ \n");
+    printf("Map: %s\n", sName.c_str());
+    printf("Map dimemsions: %dx%d\n", nMapWidth, nMapHeight);
+    printf("Start (%d,%d)    Target (%d,%d)\n", nStartX, nStartY, nTargetX, nTargetY);
+
+    int* OutBuffer = new int[nOutBufferSize];
+
+    auto start = std::chrono::system_clock::now();
+
+    cMapPreprocessor* pp = new cMapPreprocessor();
+    pp->Preprocess(pMap, nMapWidth, nMapHeight);
+
+    auto end = std::chrono::system_clock::now();
+    printf("Preprocessing time: %lld milliseconds\n",
+          std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+
+    size_t nExpanded[2][2];
+    size_t nWalked = 0;
+    int nResults[2][2];
+    bool bValid[2][2];
+
+    for (int nPreprocessed=0; nPreprocessed<2; ++nPreprocessed)
+    {
+      printf("Starting the search...%s\n", nPreprocessed ? "Preprocessed" : "Plain");
+
+      cPathfinderWorker* worker = new cPathfinderWorker();
+      if (nPreprocessed) worker->UsePreprocessedMap(pp);
+
+      start = std::chrono::system_clock::now();
+      nResults[0][nPreprocessed] = worker->FindPath(nStartX, nStartY, nTargetX, nTargetY,
+                                                    pMap, nMapWidth, nMapHeight,
+                                                    OutBuffer, nOutBufferSize);
+      end = std::chrono::system_clock::now();
+      nExpanded[0][nPreprocessed] = worker->getNodesExpanded();
+      nWalked = worker->getCorridorCellsWalked();
+      bValid[0][nPreprocessed] = IsValidPath(pMap, nMapWidth, nMapHeight, nStartX, nStartY, nTargetX, nTargetY,
+                                             OutBuffer, nResults[0][nPreprocessed]);
+      printf("Execution time: %lld milliseconds\n",
+            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+      delete worker;
+
+      cFrontierSearchWorker* frontier = new cFrontierSearchWorker();
+      if (nPreprocessed) frontier->UsePreprocessedMap(pp);
+
+      start = std::chrono::system_clock::now();
+      nResults[1][nPreprocessed] = frontier->FindPath(nStartX, nStartY, nTargetX, nTargetY,
+                                                      pMap, nMapWidth, nMapHeight,
+                                                      OutBuffer, nOutBufferSize);
+      end = std::chrono::system_clock::now();
+      nExpanded[1][nPreprocessed] = frontier->getNodesExpanded();
+      bValid[1][nPreprocessed] = IsValidPath(pMap, nMapWidth, nMapHeight, nStartX, nStartY, nTargetX, nTargetY,
+                                             OutBuffer, nResults[1][nPreprocessed]);
+      printf("Execution time: %lld milliseconds\n",
+            std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+      delete frontier;
+    }
+
+    const char* sEngines[2] = {"Search", "Frontier search"};
+    for (int nEngine=0; nEngine<2; ++nEngine)
+    {
+      printf("%s: path length %d / %d, nodes expanded %zu -> %zu (%.1f%% fewer)%s\n",
+             sEngines[nEngine], nResults[nEngine][0], nResults[nEngine][1],
+             nExpanded[nEngine][0], nExpanded[nEngine][1],
+             100.0 * (1.0 - static_cast<double>(nExpanded[nEngine][1]) /
+                            std::max<size_t>(nExpanded[nEngine][0], 1)),
+             nResults[nEngine][0] < 0 || (bValid[nEngine][0] && bValid[nEngine][1]) ? "" : "  PATH IS NOT VALID");
+    }
+    printf("Search: corridor cells walked %zu\n", nWalked);
+
+    delete pp;
+    delete [] OutBuffer;
+}
+
+
+void UnitTest_PreprocessingMazes()
+{
+  // the serpentine map saved by UnitTest_LoadSaveMap
+  unsigned char SerpentineMap[10*10];
+  LoadMapFromFile("LoadSaveTest.map", SerpentineMap, 10*10);
+  UnitTest_Preprocessing("LoadSaveTest.map", SerpentineMap, 10, 10, 0, 0, 9, 9, 100);
+
+  unsigned int nMazeSizes[2] = {501, 2001};
+  for (auto nMazeSize : nMazeSizes)
+  {
+    unsigned char* pMaze = new unsigned char[nMazeSize*nMazeSize];
+
+    GenerateMazeMap(pMaze, nMazeSize, nMazeSize, 0, nMazeSize);
+    UnitTest_Preprocessing("Perfect maze", pMaze, nMazeSize, nMazeSize,
+                           1, 1, nMazeSize-2, nMazeSize-2, nMazeSize*nMazeSize);
+
+    GenerateMazeMap(pMaze, nMazeSize, nMazeSize, nMazeSize*nMazeSize/50, nMazeSize);
+    UnitTest_Preprocessing("Maze with loops", pMaze, nMazeSize, nMazeSize,
+                           1, 1, nMazeSize-2, nMazeSize-2, nMazeSize*nMazeSize);
+
+    delete [] pMaze;
+  }
+
+  // rows and columns must not be mixed up
+  unsigned int nWidth  = 1001;
+  unsigned int nHeight = 301;
+  unsigned char* pMaze = new unsigned char[nWidth*nHeight];
+  GenerateMazeMap(pMaze, nWidth, nHeight, nWidth*nHeight/50, nWidth);
+  UnitTest_Preprocessing("Wide maze with loops", pMaze, nWidth, nHeight,
+                         1, nHeight-2, nWidth-2, 1, nWidth*nHeight);
+  delete [] pMaze;
+}
+
+
+// Short range queries between open cells, the same for every run of a client
+std::vector<sPathQuery> GenerateQueries(const unsigned char* pMap,
+                                        unsigned int nMapWidth, unsigned int nMapHeight,
+                                        unsigned int nQueries, unsigned int nRange, unsigned int nSeed)
+{
+  std::vector<sPathQuery> vecQueries;
+  srand(nSeed);
+  while (vecQueries.size() < nQueries)
+  {
+    sPathQuery query;
+    query.nStartX  = rand() % nMapWidth;
+    query.nStartY  = rand() % nMapHeight;
+    query.nTargetX = std::min<int>(nMapWidth-1,  query.nStartX + rand() % nRange);
+    query.nTargetY = std::min<int>(nMapHeight-1, query.nStartY + rand() % nRange);
+    query.nOutBufferSize = 4*nRange*nRange;
+
+    if (pMap[query.nStartY*nMapWidth+query.nStartX] == 1 &&
+        pMap[query.nTargetY*nMapWidth+query.nTargetX] == 1) vecQueries.push_back(query);
+  }
+  return vecQueries;
+}
+
+
+cPathfinderServer* pTestServer = nullptr;
+
+void StopTestServer(int)
+{
+  if (pTestServer) pTestServer->Stop();
+}
+
+
+void UnitTest_Server(unsigned int nMapSize, unsigned int nQueriesPerClient)
+{
+  printf("\n~~~ UnitTest_Server ~~~ \n");
+
+  std::string path("ServerTest.map");
+  unsigned int nRange = 64;
+
+  unsigned char* pMap = new unsigned char[nMapSize*nMapSize];
+  GenerateMazeMap(pMap, nMapSize, nMapSize, nMapSize*nMapSize/10, nMapSize);
+  SaveMapToFile(path, pMap, nMapSize*nMapSize);
+
+  printf("Map dimemsions: %dx%d\n", nMapSize, nMapSize);
+  printf("Queries per client: %d, Query range: %d\n", nQueriesPerClient, nRange);
+
+  unsigned int nClientCounts[3] = {4, 8, 16};
+
+  // the queries are made up front so that the clients do not inherit our copy of the map
+  std::vector<std::vector<sPathQuery> > vecClientQueries;
+  for (unsigned int nClient=0; nClient<nClientCounts[2]; ++nClient)
+  {
+    vecClientQueries.push_back(GenerateQueries(pMap, nMapSize, nMapSize, nQueriesPerClient, nRange, nClient));
+  }
+  delete [] pMap;
+
+  // every figure is measured in separate processes, workers print a line per
+  // query so their output is discarded
+  std::string sSocket = "/tmp/pathfinder_test_" + std::to_string(getpid()) + ".sock";
+  std::string sSharedMemory = "/pathfinder_test_" + std::to_string(getpid());
+
+  for (auto nClients : nClientCounts)
+  {
+    for (int bShared=0; bShared<2; ++bShared)
+    {
+      fflush(stdout);
+
+      pid_t pidServer = -1;
+      if (bShared)
+      {
+        pidServer = fork();
+        if (pidServer == 0)
+        {
+          if (!freopen("/dev/null", "w", stdout)) _exit(1);
+          pTestServer = new cPathfinderServer(sSocket, sSharedMemory, std::thread::hardware_concurrency());
+          signal(SIGTERM, StopTestServer);
+          bool bServed = pTestServer->LoadMap(path, nMapSize, nMapSize) && pTestServer->Run();
+          delete pTestServer;
+          _exit(bServed ? 0 : 1);
+        }
+
+        // wait until the server accepts connections
+        cPathfinderClient probe(sSocket);
+        while (!probe.Connect()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+
+      // clients report when they are set up and wait for everyone else before searching
+      int fdReady[2];
+      int fdGo[2];
+      if (pipe(fdReady) != 0 || pipe(fdGo) != 0) abort();
+
+      std::vector<pid_t> vecClients;
+      for (unsigned int nClient=0; nClient<nClients; ++nClient)
+      {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+          if (!freopen("/dev/null", "w", stdout)) _exit(1);
+          close(fdReady[0]);
+          close(fdGo[1]);
+
+          std::vector<sPathQuery>& vecQueries = vecClientQueries[nClient];
+          std::vector<int> vecOutBuffer(4*nRange*nRange);
+          int nFound = 0;
+          char cSignal = 0;
+
+          if (bShared)
+          {
+            cPathfinderClient client(sSocket);
+            if (!client.Connect()) _exit(1);
+
+            if (write(fdReady[1], &cSignal, 1) != 1 || read(fdGo[0], &cSignal, 1) != 1) _exit(1);
+            for (auto& query : vecQueries)
+            {
+              if (client.FindPath(query.nStartX, query.nStartY, query.nTargetX, query.nTargetY,
+                                  client.getMap(), nMapSize, nMapSize,
+                                  vecOutBuffer.data(), query.nOutBufferSize) >= 0) ++nFound;
+            }
+          }
+          else
+          {
+            // each process holds its own copy of the map, as game logic does today
+            unsigned char* pOwnMap = new unsigned char[nMapSize*nMapSize];
+            LoadMapFromFile(path, pOwnMap, nMapSize*nMapSize);
+            cPathfinder pf(false, false);
+
+            if (write(fdReady[1], &cSignal, 1) != 1 || read(fdGo[0], &cSignal, 1) != 1) _exit(1);
+            for (auto& query : vecQueries)
+            {
+              if (pf.FindPath(query.nStartX, query.nStartY, query.nTargetX, query.nTargetY,
+                              pOwnMap, nMapSize, nMapSize,
+                              vecOutBuffer.data(), query.nOutBufferSize) >= 0) ++nFound;
+            }
+            delete [] pOwnMap;
+          }
+          _exit(nFound == static_cast<int>(nQueriesPerClient) ? 0 : 1);
+        }
+        vecClients.push_back(pid);
+      }
+
+      close(fdReady[1]);
+      close(fdGo[0]);
+
+      char cSignal = 0;
+      for (unsigned int nClient=0; nClient<nClients; ++nClient)
+      {
+        if (read(fdReady[0], &cSignal, 1) != 1) break;
+      }
+
+      auto start = std::chrono::system_clock::now();
+      for (unsigned int nClient=0; nClient<nClients; ++nClient)
+      {
+        if (write(fdGo[1], &cSignal, 1) != 1) break;
+      }
+      close(fdReady[0]);
+      close(fdGo[1]);
+
+      long nTotalKb = 0;
+      bool bAllFound = true;
+      for (auto pid : vecClients)
+      {
+        int nStatus;
+        struct rusage usage;
+        wait4(pid, &nStatus, 0, &usage);
+        nTotalKb += usage.ru_maxrss;
+        bAllFound = bAllFound && WIFEXITED(nStatus) && WEXITSTATUS(nStatus) == 0;
+      }
+
+      auto end = std::chrono::system_clock::now();
+      long long nMilliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+      if (bShared)
+      {
+        int nStatus;
+        struct rusage usage;
+        kill(pidServer, SIGTERM);
+        wait4(pidServer, &nStatus, 0, &usage);
+        nTotalKb += usage.ru_maxrss;
+      }
+
+      printf("Clients: %2d  %-10s  Time: %6lld ms  Throughput: %8.1f queries/s  Peak memory (all processes): %7ld kb  %s\n",
+             nClients, bShared ? "server" : "in-process", nMilliseconds,
+             1000.0 * nClients * nQueriesPerClient / std::max<long long>(nMilliseconds, 1),
+             nTotalKb, bAllFound ? "" : "SOME PATHS NOT FOUND");
+    }
+  }
+
+  // A single batch whose queries all offer an out buffer as large as the map.
+  // The server only keeps the paths themselves, so it should stay close to the size of the map
+  printf("Batch of %d queries with out buffers of %d nodes\n", nQueriesPerClient, nMapSize*nMapSize);
+  fflush(stdout);
+
+  pid_t pidServer = fork();
+  if (pidServer == 0)
+  {
+    if (!freopen("/dev/null", "w", stdout)) _exit(1);
+    pTestServer = new cPathfinderServer(sSocket, sSharedMemory, std::thread::hardware_concurrency());
+    signal(SIGTERM, StopTestServer);
+    bool bServed = pTestServer->LoadMap(path, nMapSize, nMapSize) && pTestServer->Run();
+    delete pTestServer;
+    _exit(bServed ? 0 : 1);
+  }
+
+  cPathfinderClient client(sSocket);
+  while (!client.Connect()) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  std::vector<sPathQuery> vecQueries(vecClientQueries[0]);
+  for (auto& query : vecQueries) query.nOutBufferSize = nMapSize*nMapSize;
+
+  // the paths are short, so the client can let all of them share one buffer
+  int* pOutBuffer = new int[nMapSize*nMapSize];
+  std::vector<int*> vecOutBuffers(vecQueries.size(), pOutBuffer);
+  std::vector<int> vecResults;
+  bool bAnswered = client.FindPaths(vecQueries, vecOutBuffers, vecResults);
+  delete [] pOutBuffer;
+
+  int nStatus;
+  struct rusage usage;
+  kill(pidServer, SIGTERM);
+  wait4(pidServer, &nStatus, 0, &usage);
+
+  long nMapKb = nMapSize*nMapSize/1024;
+  printf("Server peak memory: %ld kb, Map: %ld kb  %s\n", usage.ru_maxrss, nMapKb,
+         !bAnswered ? "BATCH NOT ANSWERED" : (usage.ru_maxrss > 4*nMapKb ? "TOO MUCH MEMORY" : ""));
+}
+
+
+// Moves every agent that wants to and has a free cell to go to, like a game tick would.
+// Agents may follow each other but not pass through each other.
+// Returns the number of agents that were blocked by someone else
+int ExecuteMoves(std::vector<int>& vecCells, const std::vector<int>& vecWanted,
+                 std::vector<int>& vecOccupied, std::vector<bool>& vecBlocked)
+{
+  bool bMoved = true;
+  while (bMoved)
+  {
+    bMoved = false;
+    for (unsigned int i=0; i<vecCells.size(); ++i)
+    {
+      if (vecWanted[i] == vecCells[i] || vecOccupied[vecWanted[i]] != -1) continue;
+
+      vecOccupied[vecCells[i]] = -1;
+      vecOccupied[vecWanted[i]] = i;
+      vecCells[i] = vecWanted[i];
+      bMoved = true;
+    }
+  }
+
+  int nBlocked = 0;
+  for (unsigned int i=0; i<vecCells.size(); ++i)
+  {
+    vecBlocked[i] = vecWanted[i] != vecCells[i];
+    if (vecBlocked[i]) ++nBlocked;
+  }
+  return nBlocked;
+}
+
+
+void UnitTest_Cooperative(std::string sName, const unsigned char* pMap, unsigned int nMapSize,
+                          unsigned int nAgents, unsigned int nRange, unsigned int nMaxTicks)
+{
+    printf("\n~~~ UnitTest_Cooperative ~~~ \n");
+    printf("Map: %s %dx%d, Agents: %d, Target range: %d\n", sName.c_str(), nMapSize, nMapSize, nAgents, nRange);
+
+    // label the connected areas so that every target can be reached
+    std::vector<int> vecArea(nMapSize*nMapSize, -1);
+    for (unsigned int i=0; i<nMapSize*nMapSize; ++i)
+    {
+      if (pMap[i] != 1 || vecArea[i] >= 0) continue;
+      std::vector<unsigned int> vecToVisit(1, i);
+      vecArea[i] = i;
+      while (!vecToVisit.empty())
+      {
+        unsigned int nCell = vecToVisit.back();
+        vecToVisit.pop_back();
+        unsigned int nAdj[4] = {nCell+1, nCell-1, nCell+nMapSize, nCell-nMapSize};
+        for (int j=0; j<4; ++j)
+        {
+          if (nAdj[j] >= nMapSize*nMapSize || pMap[nAdj[j]] != 1 || vecArea[nAdj[j]] >= 0) continue;
+          if ((j < 2) && nAdj[j] / nMapSize != nCell / nMapSize) continue;
+          vecArea[nAdj[j]] = i;
+          vecToVisit.push_back(nAdj[j]);
+        }
+      }
+    }
+
+    srand(nAgents);
+    std::vector<int> vecStarts;
+    std::vector<int> vecTargets;
+    std::vector<bool> vecStartTaken(nMapSize*nMapSize, false);
+    std::vector<bool> vecTargetTaken(nMapSize*nMapSize, false);
+    while (vecStarts.size() < nAgents)
+    {
+      int nStart = rand() % (nMapSize*nMapSize);
+      int nTargetX = std::min<int>(nMapSize-1, std::max<int>(0, nStart % nMapSize + rand() % (2*nRange) - nRange));
+      int nTargetY = std::min<int>(nMapSize-1, std::max<int>(0, nStart / nMapSize + rand() % (2*nRange) - nRange));
+      int nTarget = nTargetY*nMapSize+nTargetX;
+
+      if (pMap[nStart] != 1 || pMap[nTarget] != 1 || vecArea[nStart] != vecArea[nTarget] ||
+          vecStartTaken[nStart] || vecTargetTaken[nTarget]) continue;
+
+      vecStartTaken[nStart] = true;
+      vecTargetTaken[nTarget] = true;
+      vecStarts.push_back(nStart);
+      vecTargets.push_back(nTarget);
+    }
+
+    // workers print a line per search, keep them quiet while we measure
+    int fdNull = open("/dev/null", O_WRONLY);
+    int fdStdout = dup(fileno(stdout));
+
+    const char* sModes[2] = {"independent", "cooperative"};
+    for (int bCooperative=0; bCooperative<2; ++bCooperative)
+    {
+      std::vector<int> vecCells(vecStarts);
+      std::vector<int> vecWanted(vecStarts);
+      std::vector<bool> vecBlocked(nAgents, false);
+      std::vector<int> vecOccupied(nMapSize*nMapSize, -1);
+      for (unsigned int i=0; i<nAgents; ++i) vecOccupied[vecCells[i]] = i;
+
+      size_t nSearches   = 0;
+      size_t nReplans    = 0;
+      size_t nFailed     = 0;
+      size_t nCollisions = 0;
+      double fTotalCpu = 0.0;
+      double fMaxCpu   = 0.0;
+      unsigned int nTick = 0;
+      unsigned int nArrived = 0;
+
+      fflush(stdout);
+      dup2(fdNull, fileno(stdout));
+
+      // Independent planning: every agent follows its own path and searches again around
+      // the agents that stand in its way whenever it bumps into one of them.
+      // When the others block every way to the target it keeps to the path over the empty map
+      // and waits twice as long before each next attempt
+      std::vector<std::vector<int> > vecPaths(nAgents);
+      std::vector<unsigned int> vecBackoff(nAgents, 1);
+      std::vector<unsigned int> vecNextReplan(nAgents, 0);
+      std::vector<unsigned char> vecOccupiedMap(pMap, pMap+nMapSize*nMapSize);
+      std::vector<int> vecOutBuffer(nMapSize*nMapSize);
+
+      auto FindPath = [&](unsigned int nAgent, const unsigned char* pSearchMap)
+      {
+        cPathfinderWorker* worker = new cPathfinderWorker();
+        int nResult = worker->FindPath(vecCells[nAgent] % nMapSize, vecCells[nAgent] / nMapSize,
+                                       vecTargets[nAgent] % nMapSize, vecTargets[nAgent] / nMapSize,
+                                       pSearchMap, nMapSize, nMapSize,
+                                       vecOutBuffer.data(), vecOutBuffer.size());
+        delete worker;
+        ++nSearches;
+
+        // the path comes target first, so the next step is at the back
+        vecPaths[nAgent].assign(vecOutBuffer.begin(), vecOutBuffer.begin() + std::max(nResult, 0));
+        return nResult >= 0;
+      };
+
+      cCooperativePlanner planner(pMap, nMapSize, nMapSize, 16);
+      unsigned int nStep = 0;
+      bool bReplan = false;
+
+      std::clock_t start = std::clock();
+      if (bCooperative)
+      {
+        for (unsigned int i=0; i<nAgents; ++i)
+        {
+          planner.AddAgent(vecStarts[i] % nMapSize, vecStarts[i] / nMapSize,
+                           vecTargets[i] % nMapSize, vecTargets[i] / nMapSize);
+        }
+        nFailed += planner.Plan();
+        nStep = 0;
+      }
+      else
+      {
+        for (unsigned int i=0; i<nAgents; ++i)
+        {
+          FindPath(i, pMap);
+          vecOccupiedMap[vecCells[i]] = 0;
+        }
+      }
+      double fInitialCpu = 1000.0 * (std::clock() - start) / CLOCKS_PER_SEC;
+
+      for (nTick=0; nTick<nMaxTicks; ++nTick)
+      {
+        start = std::clock();
+
+        if (bCooperative)
+        {
+          // plan every agent again halfway through the window or after somebody got blocked
+          if (nStep >= static_cast<unsigned int>(planner.getWindow()/2) || bReplan)
+          {
+            nFailed += planner.Plan();
+            nStep = 0;
+          }
+          ++nStep;
+          for (unsigned int i=0; i<nAgents; ++i) vecWanted[i] = planner.getPlannedCell(i, nStep);
+        }
+        else
+        {
+          for (unsigned int i=0; i<nAgents; ++i)
+          {
+            vecWanted[i] = vecPaths[i].empty() ? vecCells[i] : vecPaths[i].back();
+          }
+        }
+
+        std::vector<int> vecPrevious(vecCells);
+        int nBlocked = ExecuteMoves(vecCells, vecWanted, vecOccupied, vecBlocked);
+        nCollisions += nBlocked;
+
+        nArrived = 0;
+        for (unsigned int i=0; i<nAgents; ++i)
+        {
+          if (vecCells[i] == vecTargets[i]) ++nArrived;
+
+          if (bCooperative)
+          {
+            planner.SetPosition(i, vecCells[i] % nMapSize, vecCells[i] / nMapSize);
+            continue;
+          }
+
+          if (vecCells[i] != vecPrevious[i])
+          {
+            vecPaths[i].pop_back();
+            vecOccupiedMap[vecPrevious[i]] = 1;
+            vecOccupiedMap[vecCells[i]] = 0;
+          }
+
+          // blocked or stuck without a path, look for a way around the others
+          if ((vecBlocked[i] || (vecPaths[i].empty() && vecCells[i] != vecTargets[i])) &&
+              nTick >= vecNextReplan[i])
+          {
+            ++nReplans;
+            if (FindPath(i, vecOccupiedMap.data()))
+            {
+              vecBackoff[i] = 1;
+              continue;
+            }
+
+            ++nFailed;
+            FindPath(i, pMap);
+            vecNextReplan[i] = nTick + vecBackoff[i];
+            vecBackoff[i] = std::min(2*vecBackoff[i], 32u);
+          }
+        }
+        bReplan = nBlocked > 0;
+
+        double fCpu = 1000.0 * (std::clock() - start) / CLOCKS_PER_SEC;
+        fTotalCpu += fCpu;
+        fMaxCpu = std::max(fMaxCpu, fCpu);
+
+        if (nArrived == nAgents) break;
+      }
+
+      fflush(stdout);
+      dup2(fdStdout, fileno(stdout));
+
+      // the planner plans everybody again while agents collide with earlier plans
+      if (bCooperative) nReplans = planner.getWindowSearches() - nAgents;
+
+      // Replans: an agent's plan made again after the initial one, whatever the reason
+      // Failed: searches that found no way through the other agents
+      // Searches: every search run, cooperative also counts the distance searches
+      // Conflicts: cooperative plans still running into another agent's reservation after the last planning round
+      size_t nAllSearches = bCooperative ? planner.getWindowSearches() + planner.getDistanceSearches() : nSearches;
+      printf("%-11s  Ticks: %3d  Arrived: %4d/%4d  Blocked moves: %6zu  Replans: %7zu  Failed: %6zu  "
+             "Searches: %7zu  Conflicts: %5zu  Initial: %7.1f ms  CPU per tick: %6.2f ms avg %7.2f ms max\n",
+             sModes[bCooperative], nTick, nArrived, nAgents, nCollisions, nReplans, nFailed, nAllSearches,
+             planner.getConflicts(), fInitialCpu, fTotalCpu / std::max(nTick, 1u), fMaxCpu);
+    }
+
+    close(fdStdout);
+    close(fdNull);
+}
+
+
+void UnitTest_CooperativeMaps()
+{
+  unsigned int nMapSize = 257;
+  unsigned char* pMap = new unsigned char[nMapSize*nMapSize];
+  unsigned int nAgentCounts[4] = {100, 250, 500, 1000};
+
+  srand(1);
+  for (unsigned int i=0; i<nMapSize*nMapSize; ++i) pMap[i] = (rand() % 4 != 0) ? 1 : 0;
+  for (auto nAgents : nAgentCounts) UnitTest_Cooperative("Random", pMap, nMapSize, nAgents, 32, 256);
+
+  GenerateMazeMap(pMap, nMapSize, nMapSize, nMapSize*nMapSize/10, nMapSize);
+  for (auto nAgents : nAgentCounts) UnitTest_Cooperative("Maze with loops", pMap, nMapSize, nAgents, 32, 256);
+
+  delete [] pMap;
+}
+
+
 
 
 int main(int argc, const char* argv[])
@@ -290,6 +1100,10 @@ int main(int argc, const char* argv[])
     case 2: UnitTest_Pathfinder(path, nMapSizeBytes, nOutBufferSize, false, true); break;
     case 3: UnitTest_Pathfinder(path, nMapSizeBytes, nOutBufferSize, true, true); break;
     case 4: UnitTest_Pathfinder(path, nMapSizeBytes, nOutBufferSize, true, false); break;
+    case 5: UnitTest_MemoryBounded(path, nMapSizeBytes, nOutBufferSize, 16*1024*1024); break;
+    case 6: UnitTest_PreprocessingMazes(); break;
+    case 7: UnitTest_Server(4001, 200); break;
+    case 8: UnitTest_CooperativeMaps(); break;
     default: printf("No option specified\n");
   }
 